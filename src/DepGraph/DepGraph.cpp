@@ -1,11 +1,24 @@
 #include "DepGraph.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cctype>
+
 
 using namespace llvm;
 
 static cl::opt<bool, false>
 includeAllInstsInDepGraph("includeAllInstsInDepGraph", cl::desc("Include All Instructions In DepGraph."), cl::NotHidden);
 
+static cl::opt<unsigned>
+depGraphThreads("depGraphThreads", cl::desc("Number of threads that build the module DepGraph (0: one per core)."), cl::init(0), cl::NotHidden);
+
+static cl::opt<std::string>
+depGraphCache("depGraphCache", cl::desc("File the module DepGraph is loaded from if it matches the module, and saved to otherwise. functionDepGraph keeps one file per function, named <file>.<function>."), cl::init(""), cl::NotHidden);
+
 
 
 //*********************************************************************************************************************************************************************
@@ -55,11 +68,11 @@ GraphNode::~GraphNode() {
         predecessors.clear();
 }
 
-std::map<GraphNode*, edgeType> llvm::GraphNode::getSuccessors() {
+const std::map<GraphNode*, edgeType>& llvm::GraphNode::getSuccessors() {
         return successors;
 }
 
-std::map<GraphNode*, edgeType> llvm::GraphNode::getPredecessors() {
+const std::map<GraphNode*, edgeType>& llvm::GraphNode::getPredecessors() {
         return predecessors;
 }
 
@@ -126,7 +139,7 @@ llvm::raw_ostream& GraphNode::dump(llvm::raw_ostream &strm){
 //  return a.dump(strm);
 //}
 
-int llvm::GraphNode::currentID = 0;
+std::atomic<int> llvm::GraphNode::currentID(0);
 
 /*
  * Class OpNode
@@ -292,6 +305,56 @@ std::string llvm::BackNode::getShape() {
 	return std::string("point");
 }
 
+/*
+ * Class CompactGraph
+ */
+llvm::CompactGraph::CompactGraph(const std::set<GraphNode*> &nodes, bool restrictToNodes) :
+	numGraphNodes(nodes.size()) {
+
+	nodeList.reserve(nodes.size());
+	for (std::set<GraphNode*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+		getOrAddID(*it);
+	}
+
+	//Nodes reached only through edges are appended to nodeList while it is traversed
+	succOffsets.push_back(0);
+	predOffsets.push_back(0);
+	for (unsigned ID = 0; ID < nodeList.size(); ++ID) {
+
+		const std::map<GraphNode*, edgeType> &succs = nodeList[ID]->getSuccessors();
+		for (std::map<GraphNode*, edgeType>::const_iterator succ = succs.begin(); succ != succs.end(); ++succ) {
+			if (restrictToNodes && !nodeIDs.count(succ->first)) continue;
+			succTargets.push_back(getOrAddID(succ->first));
+			succControl.push_back(succ->second == etControl);
+		}
+		succOffsets.push_back(succTargets.size());
+
+		const std::map<GraphNode*, edgeType> &preds = nodeList[ID]->getPredecessors();
+		for (std::map<GraphNode*, edgeType>::const_iterator pred = preds.begin(); pred != preds.end(); ++pred) {
+			if (restrictToNodes && !nodeIDs.count(pred->first)) continue;
+			predTargets.push_back(getOrAddID(pred->first));
+			predControl.push_back(pred->second == etControl);
+		}
+		predOffsets.push_back(predTargets.size());
+	}
+
+}
+
+unsigned llvm::CompactGraph::getOrAddID(GraphNode* node) {
+
+	std::pair<llvm::DenseMap<GraphNode*, unsigned>::iterator, bool> entry =
+			nodeIDs.insert(std::make_pair(node, (unsigned)nodeList.size()));
+	if (entry.second) nodeList.push_back(node);
+
+	return entry.first->second;
+}
+
+int llvm::CompactGraph::getNodeID(GraphNode* node) const {
+
+	llvm::DenseMap<GraphNode*, unsigned>::const_iterator entry = nodeIDs.find(node);
+	return entry == nodeIDs.end() ? -1 : (int)entry->second;
+}
+
 /*
  * Class Graph
  */
@@ -311,6 +374,16 @@ Graph* Graph::getParentGraph(){
 	return parentGraph;
 }
 
+const CompactGraph& Graph::getCompactGraph(){
+
+	if (!compactGraphValid) {
+		compactGraph = CompactGraph(nodes);
+		compactGraphValid = true;
+	}
+
+	return compactGraph;
+}
+
 Graph Graph::generateSubGraph(Value *src, Value *dst) {
 
         GraphNode* source = findOpNode(src);
@@ -363,8 +436,7 @@ Graph* Graph::clone(){
 	*result = makeSubGraph(nodes);
 	result->parentGraph = NULL;  //Make the graphs independent
 
-	result->sCCs.clear();
-	result->reverseSCCMap.clear();
+	result->invalidateSCCs();
 
 	return result;
 
@@ -385,9 +457,9 @@ Graph Graph::makeSubGraph(std::set<GraphNode*> nodeList){
     //Copy the vertices
     for (std::map<GraphNode*, GraphNode*>::iterator it = G.nodeMap.begin(); it != G.nodeMap.end(); ++it) {
 
-            std::map<GraphNode*, edgeType> succs = it->first->getSuccessors();
+            const std::map<GraphNode*, edgeType> &succs = it->first->getSuccessors();
 
-            for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end = succs.end(); succ != s_end; succ++) {
+            for (std::map<GraphNode*, edgeType>::const_iterator succ = succs.begin(), s_end = succs.end(); succ != s_end; succ++) {
                     if (G.nodeMap.count(succ->first)) {
                             it->second->connect(G.nodeMap[succ->first], succ->second);
                     }
@@ -428,111 +500,119 @@ Graph Graph::makeSubGraph(std::set<GraphNode*> nodeList){
 
 }
 
-void Graph::dfsVisit(GraphNode* u, std::set<GraphNode*> &visitedNodes) {
+/*
+ * Depth-first search on the compact graph, visiting the nodes in the same order as a
+ * recursive search would. Nodes marked in seen are not entered; visit is called on
+ * every node reached, in preorder.
+ */
+template<class Visitor>
+static void compactDFS(const CompactGraph &CG, unsigned start, bool backwards,
+		std::vector<char> &seen, Visitor visit) {
 
-        visitedNodes.insert(u);
+	std::vector<std::pair<unsigned, CompactGraph::edge_iterator> > stack;
 
-        std::map<GraphNode*, edgeType> succs = u->getSuccessors();
+	seen[start] = 1;
+	visit(start);
+	stack.push_back(std::make_pair(start, backwards ? CG.pred_begin(start) : CG.succ_begin(start)));
 
-        for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end =
-                        succs.end(); succ != s_end; succ++) {
-                if (visitedNodes.count(succ->first) == 0) {
-                        dfsVisit(succ->first, visitedNodes);
-                }
-        }
+	while (!stack.empty()) {
 
-}
+		unsigned ID = stack.back().first;
+		CompactGraph::edge_iterator end = backwards ? CG.pred_end(ID) : CG.succ_end(ID);
 
+		CompactGraph::edge_iterator next = stack.back().second;
+		while (next != end && seen[*next]) next++;
 
+		if (next == end) {
+			stack.pop_back();
+			continue;
+		}
 
-void Graph::dfsVisitBack(GraphNode* u, std::set<GraphNode*> &visitedNodes) {
+		unsigned child = *next;
+		stack.back().second = ++next;
 
-        visitedNodes.insert(u);
+		seen[child] = 1;
+		visit(child);
+		stack.push_back(std::make_pair(child, backwards ? CG.pred_begin(child) : CG.succ_begin(child)));
+	}
 
-        std::map<GraphNode*, edgeType> preds = u->getPredecessors();
+}
 
-        for (std::map<GraphNode*, edgeType>::iterator pred = preds.begin(), s_end =
-                        preds.end(); pred != s_end; pred++) {
-                if (visitedNodes.count(pred->first) == 0) {
-                        dfsVisitBack(pred->first, visitedNodes);
-                }
-        }
+//Return a flag per node of the compact graph, set for the given nodes
+static std::vector<char> markNodes(const CompactGraph &CG, const std::set<GraphNode*> &marked) {
 
-}
+	std::vector<char> flags(CG.getNumNodes(), 0);
 
+	for (std::set<GraphNode*>::const_iterator it = marked.begin(); it != marked.end(); ++it) {
+		int ID = CG.getNodeID(*it);
+		if (ID >= 0) flags[ID] = 1;
+	}
 
+	return flags;
+}
 
+void Graph::dfsVisit(GraphNode* u, std::set<GraphNode*> &visitedNodes) {
 
+        const CompactGraph &CG = getCompactGraph();
+        int start = CG.getNodeID(u);
 
+        visitedNodes.insert(u);
+        if (start < 0) return;
 
-void Graph::dfsVisitBack_ext(GraphNode* u, std::set<GraphNode*> &visitedNodes, std::map<int, GraphNode*> &firstNodeVisitedPerSCC){
+        std::vector<char> seen = markNodes(CG, visitedNodes);
 
-    visitedNodes.insert(u);
-    int SCCID = getSCCID(u);
+        compactDFS(CG, start, false, seen, [&](unsigned ID) {
+                visitedNodes.insert(CG.getNode(ID));
+        });
 
-    if (!firstNodeVisitedPerSCC.count(SCCID)) firstNodeVisitedPerSCC[SCCID] = u;
+}
 
-    std::map<GraphNode*, edgeType> preds = u->getPredecessors();
 
-    for (std::map<GraphNode*, edgeType>::iterator pred = preds.begin(), s_end =
-                    preds.end(); pred != s_end; pred++) {
-		if (visitedNodes.count(pred->first) == 0) {
-			dfsVisitBack_ext(pred->first, visitedNodes, firstNodeVisitedPerSCC);
-		}
-    }
 
-}
+void Graph::dfsVisitBack(GraphNode* u, std::set<GraphNode*> &visitedNodes) {
 
-//Here we look for a back edge that leads to a node different than the first node.
-bool lookForNestedLoop( GraphNode* first,
-						GraphNode* current,
-						std::set<GraphNode*> &currentpath ,
-						std::set<GraphNode*> &visitedNodes) {
+        const CompactGraph &CG = getCompactGraph();
+        int start = CG.getNodeID(u);
 
-    bool found = false;
+        visitedNodes.insert(u);
+        if (start < 0) return;
 
-	visitedNodes.insert(current);
+        std::vector<char> seen = markNodes(CG, visitedNodes);
 
-	currentpath.insert(current);
+        compactDFS(CG, start, true, seen, [&](unsigned ID) {
+                visitedNodes.insert(CG.getNode(ID));
+        });
 
-	std::map<GraphNode*, edgeType> succs = current->getSuccessors();
+}
 
-	for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end =
-					succs.end(); succ != s_end; succ++) {
 
-		if (succ->first != first && currentpath.count(succ->first)) {
-			found = true;
-			break;
-		}
-		if (!visitedNodes.count(succ->first)) {
-			if (lookForNestedLoop(first, succ->first, currentpath, visitedNodes) ){
-				found = true;
-				break;
-			}
-		}
-	}
 
-	currentpath.erase(current);
 
-    return found;
 
-}
 
+void Graph::dfsVisitBack_ext(GraphNode* u, std::set<GraphNode*> &visitedNodes, std::map<int, GraphNode*> &firstNodeVisitedPerSCC){
 
-bool Graph::hasNestedLoop(GraphNode* first){
-	std::set<GraphNode*> currentpath;
-	std::set<GraphNode*> visitedNodes;
+    const CompactGraph &CG = getCompactGraph();
+    int start = CG.getNodeID(u);
 
-	return lookForNestedLoop( first, first, currentpath, visitedNodes);
-}
+    if (start < 0) {
+        visitedNodes.insert(u);
+        int SCCID = getSCCID(u);
+        if (!firstNodeVisitedPerSCC.count(SCCID)) firstNodeVisitedPerSCC[SCCID] = u;
+        return;
+    }
 
-bool Graph::hasNestedLoop(int SCCID){
-	std::set<GraphNode*> SCC = getSCC(SCCID);
-	GraphNode* first = *(SCC.begin());
-	return hasNestedLoop(first);
-}
+    std::vector<char> seen = markNodes(CG, visitedNodes);
 
+    compactDFS(CG, start, true, seen, [&](unsigned ID) {
+        GraphNode* node = CG.getNode(ID);
+        visitedNodes.insert(node);
 
+        int SCCID = getSCCID(node);
+        if (!firstNodeVisitedPerSCC.count(SCCID)) firstNodeVisitedPerSCC[SCCID] = node;
+    });
+
+}
 
 //Print the graph (.dot format) in the stderr stream.
 void Graph::toDot(std::string s) {
@@ -574,9 +654,9 @@ void Graph::toDot(std::string s, raw_ostream *stream) {
                         DefinedNodes[*node] = 1;
                 }
 
-                std::map<GraphNode*, edgeType> succs = (*node)->getSuccessors();
+                const std::map<GraphNode*, edgeType> &succs = (*node)->getSuccessors();
 
-                for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(),
+                for (std::map<GraphNode*, edgeType>::const_iterator succ = succs.begin(),
                                 s_end = succs.end(); succ != s_end; succ++) {
 
                         if (DefinedNodes.count(succ->first) == 0) {
@@ -621,8 +701,8 @@ void llvm::Graph::toDot(std::string s, raw_ostream *stream, llvm::Graph::Guider*
         // print edges
         for (std::set<GraphNode*>::iterator node = nodes.begin(), end = nodes.end(); node
                                 != end; node++) {
-                std::map<GraphNode*, edgeType> succs = (*node)->getSuccessors();
-                for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(),
+                const std::map<GraphNode*, edgeType> &succs = (*node)->getSuccessors();
+                for (std::map<GraphNode*, edgeType>::const_iterator succ = succs.begin(),
                                 s_end = succs.end(); succ != s_end; succ++) {
                         //Source
                         (*stream) << "\"" << (*node)->getName() << "\"";
@@ -638,6 +718,8 @@ void llvm::Graph::toDot(std::string s, raw_ostream *stream, llvm::Graph::Guider*
 
 void Graph::removeNode(GraphNode* target){
 
+	compactGraphValid = false;
+
 	if (OpNode* on = dyn_cast<OpNode>(target)){
 		opNodes.erase(on->getValue());
 		if (CallNode* cn = dyn_cast<CallNode>(target)){
@@ -651,6 +733,8 @@ void Graph::removeNode(GraphNode* target){
 		backNodes.erase(bn->getNext());
 	}
 
+    removeNodeFromSCCs(target);
+
     nodes.erase(target);
     delete target;
 
@@ -664,6 +748,9 @@ GraphNode* Graph::addInst(Value *v) {
         bool hasVarNode = true;
 
         if (isValidInst(v)) { //If is a data manipulator instruction
+                compactGraphValid = false;
+                invalidateSCCs();
+
                 Var = this->findNode(v);
 
                 /*
@@ -733,12 +820,70 @@ GraphNode* Graph::addInst(Value *v) {
         return NULL;
 }
 
+void Graph::mergeGraph(Graph &G) {
+
+        compactGraphValid = false;
+        invalidateSCCs();
+
+        //Variables and memory nodes may already be here: their copies in G are redirected to them
+        std::vector<std::pair<GraphNode*, GraphNode*> > duplicates;
+
+        for (llvm::DenseMap<Value*, GraphNode*>::iterator it = G.varNodes.begin(); it != G.varNodes.end(); ++it) {
+                llvm::DenseMap<Value*, GraphNode*>::iterator own = varNodes.find(it->first);
+                if (own != varNodes.end()) duplicates.push_back(std::make_pair(it->second, own->second));
+                else varNodes[it->first] = it->second;
+        }
+
+        for (llvm::DenseMap<int, GraphNode*>::iterator it = G.memNodes.begin(); it != G.memNodes.end(); ++it) {
+                llvm::DenseMap<int, GraphNode*>::iterator own = memNodes.find(it->first);
+                if (own != memNodes.end()) duplicates.push_back(std::make_pair(it->second, own->second));
+                else memNodes[it->first] = it->second;
+        }
+
+        opNodes.insert(G.opNodes.begin(), G.opNodes.end());
+        callNodes.insert(G.callNodes.begin(), G.callNodes.end());
+        backNodes.insert(G.backNodes.begin(), G.backNodes.end());
+
+        nodes.insert(G.nodes.begin(), G.nodes.end());
+
+        for (std::vector<std::pair<GraphNode*, GraphNode*> >::iterator it = duplicates.begin(); it != duplicates.end(); ++it) {
+
+                GraphNode* copy = it->first;
+                GraphNode* node = it->second;
+
+                std::map<GraphNode*, edgeType> succs = copy->getSuccessors();
+                for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(); succ != succs.end(); ++succ)
+                        node->connect(succ->first, succ->second);
+
+                std::map<GraphNode*, edgeType> preds = copy->getPredecessors();
+                for (std::map<GraphNode*, edgeType>::iterator pred = preds.begin(); pred != preds.end(); ++pred)
+                        pred->first->connect(node, pred->second);
+
+                nodes.erase(copy);
+                delete copy;
+        }
+
+        G.nodes.clear();
+        G.opNodes.clear();
+        G.callNodes.clear();
+        G.varNodes.clear();
+        G.memNodes.clear();
+        G.backNodes.clear();
+        G.invalidateSCCs();
+        G.compactGraphValid = false;
+
+}
+
 void Graph::addEdge(GraphNode* src, GraphNode* dst, edgeType type) {
 
+        compactGraphValid = false;
+
         nodes.insert(src);
         nodes.insert(dst);
         src->connect(dst, type);
 
+        addEdgeToSCCs(src, dst);
+
 }
 
 //It verify if the instruction is valid for the dependence graph, i.e. just data manipulator instructions are important for dependence graph
@@ -818,6 +963,8 @@ OpNode* llvm::Graph::findOpNode(llvm::Value* op) {
 
 void llvm::Graph::deleteCallNodes(Function* F) {
 
+        compactGraphValid = false;
+
         for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E; ++UI) {
                 User *U = *UI;
 
@@ -836,6 +983,7 @@ void llvm::Graph::deleteCallNodes(Function* F) {
 
                 if (callNodes.count(caller)) {
                         if (GraphNode* node = callNodes[caller]) {
+                                removeNodeFromSCCs(node);
                                 nodes.erase(node);
                                 delete node;
                         }
@@ -853,24 +1001,25 @@ std::pair<GraphNode*, int> llvm::Graph::getNearestDependency(llvm::Value* sink,
         result.first = NULL;
         result.second = -1;
 
-        if (GraphNode* startNode = findNode(sink)) {
+        GraphNode* startNode = findNode(sink);
+        const CompactGraph &CG = getCompactGraph();
 
-                std::set<GraphNode*> sourceNodes = findNodes(sources);
+        if (startNode && CG.getNodeID(startNode) >= 0) {
 
-                std::map<GraphNode*, int> nodeColor;
+                std::vector<char> isSource = markNodes(CG, findNodes(sources));
 
-                std::list<std::pair<GraphNode*, int> > workList;
+                std::vector<char> nodeColor(CG.getNumNodes(), 0);
 
-                for (std::set<GraphNode*>::iterator Nit = nodes.begin(), Nend =
-                                nodes.end(); Nit != Nend; Nit++) {
-
-                        if (skipMemoryNodes && isa<MemNode> (*Nit))
-                                nodeColor[*Nit] = 1;
-                        else
-                                nodeColor[*Nit] = 0;
+                if (skipMemoryNodes) {
+                        for (unsigned ID = 0; ID < CG.getNumGraphNodes(); ++ID) {
+                                if (isa<MemNode> (CG.getNode(ID)))
+                                        nodeColor[ID] = 1;
+                        }
                 }
 
-                workList.push_back(pair<GraphNode*, int> (startNode, 0));
+                //Nodes and their distances, in the order of the breadth-first search
+                std::vector<std::pair<unsigned, int> > workList;
+                workList.push_back(std::make_pair((unsigned)CG.getNodeID(startNode), 0));
 
                 /*
                  * we will do a breadth search on the predecessors of each node,
@@ -878,35 +1027,29 @@ std::pair<GraphNode*, int> llvm::Graph::getNearestDependency(llvm::Value* sink,
                  * sink doesn't depend on any source.
                  */
 
-                while (workList.size()) {
+                for (unsigned head = 0; head < workList.size(); ++head) {
 
-                        GraphNode* workNode = workList.front().first;
-                        int currentDistance = workList.front().second;
+                        unsigned workNode = workList[head].first;
+                        int currentDistance = workList[head].second;
 
                         nodeColor[workNode] = 1;
 
-                        workList.pop_front();
+                        if (isSource[workNode]) {
 
-                        if (sourceNodes.count(workNode)) {
-
-                                result.first = workNode;
+                                result.first = CG.getNode(workNode);
                                 result.second = currentDistance;
                                 break;
 
                         }
 
-                        std::map<GraphNode*, edgeType> preds = workNode->getPredecessors();
-
-                        for (std::map<GraphNode*, edgeType>::iterator pred = preds.begin(),
-                                        pend = preds.end(); pred != pend; pred++) {
+                        for (CompactGraph::edge_iterator pred = CG.pred_begin(workNode),
+                                        pend = CG.pred_end(workNode); pred != pend; pred++) {
 
-                                if (nodeColor[pred->first] == 0) { // the node hasn't been processed yet
+                                if (nodeColor[*pred] == 0) { // the node hasn't been processed yet
 
-                                        nodeColor[pred->first] = 1;
+                                        nodeColor[*pred] = 1;
 
-                                        workList.push_back(
-                                                        pair<GraphNode*, int> (pred->first,
-                                                                        currentDistance + 1));
+                                        workList.push_back(std::make_pair(*pred, currentDistance + 1));
 
                                 }
 
@@ -923,64 +1066,52 @@ std::map<GraphNode*, std::vector<GraphNode*> > llvm::Graph::getEveryDependency(
                 llvm::Value* sink, std::set<llvm::Value*> sources, bool skipMemoryNodes) {
 
         std::map<llvm::GraphNode*, std::vector<GraphNode*> > result;
-        DenseMap<GraphNode*, GraphNode*> parent;
         std::vector<GraphNode*> path;
 
-        //      errs() << "--- Get every dep --- \n";
-        if (GraphNode* startNode = findNode(sink)) {
-                //              errs() << "found sink\n";
-                std::set<GraphNode*> sourceNodes = findNodes(sources);
-                std::map<GraphNode*, int> nodeColor;
-                std::list<GraphNode*> workList;
-                //              int size = 0;
-                for (std::set<GraphNode*>::iterator Nit = nodes.begin(), Nend =
-                                nodes.end(); Nit != Nend; Nit++) {
-                        //                      size++;
-                        if (skipMemoryNodes && isa<MemNode> (*Nit))
-                                nodeColor[*Nit] = 1;
-                        else
-                                nodeColor[*Nit] = 0;
+        GraphNode* startNode = findNode(sink);
+        const CompactGraph &CG = getCompactGraph();
+
+        if (startNode && CG.getNodeID(startNode) >= 0) {
+
+                std::vector<char> isSource = markNodes(CG, findNodes(sources));
+
+                std::vector<char> nodeColor(CG.getNumNodes(), 0);
+                std::vector<int> parent(CG.getNumNodes(), -1);
+
+                if (skipMemoryNodes) {
+                        for (unsigned ID = 0; ID < CG.getNumGraphNodes(); ++ID) {
+                                if (isa<MemNode> (CG.getNode(ID)))
+                                        nodeColor[ID] = 1;
+                        }
                 }
 
-                workList.push_back(startNode);
-                nodeColor[startNode] = 1;
+                unsigned startID = CG.getNodeID(startNode);
+                std::vector<unsigned> workList(1, startID);
+                nodeColor[startID] = 1;
                 /*
                  * we will do a breadth search on the predecessors of each node,
                  * until we find one of the sources. If we don't find any, then the
                  * sink doesn't depend on any source.
                  */
-                //              int pb = 1;
-                while (!workList.empty()) {
-                        GraphNode* workNode = workList.front();
-                        workList.pop_front();
-                        if (sourceNodes.count(workNode)) {
+                for (unsigned head = 0; head < workList.size(); ++head) {
+                        unsigned workNode = workList[head];
+                        if (isSource[workNode]) {
                                 //Retrieve path
                                 path.clear();
-                                GraphNode* n = workNode;
-                                path.push_back(n);
-                                while (parent.count(n)) {
-                                        path.push_back(parent[n]);
-                                        n = parent[n];
+                                for (int n = workNode; n >= 0; n = parent[n]) {
+                                        path.push_back(CG.getNode(n));
                                 }
                                 std::reverse(path.begin(), path.end());
-                                //                              errs() << "Path: ";
-                                //                              for (std::vector<GraphNode*>::iterator i = path.begin(), e = path.end(); i != e; ++i) {
-                                //                                      errs() << (*i)->getLabel() << " | ";
-                                //                              }
-                                //                              errs() << "\n";
-                                result[workNode] = path;
+                                result[CG.getNode(workNode)] = path;
                         }
-                        std::map<GraphNode*, edgeType> preds = workNode->getPredecessors();
-                        for (std::map<GraphNode*, edgeType>::iterator pred = preds.begin(),
-                                        pend = preds.end(); pred != pend; pred++) {
-                                if (nodeColor[pred->first] == 0) { // the node hasn't been processed yet
-                                        nodeColor[pred->first] = 1;
-                                        workList.push_back(pred->first);
-                                        //                                      pb++;
-                                        parent[pred->first] = workNode;
+                        for (CompactGraph::edge_iterator pred = CG.pred_begin(workNode),
+                                        pend = CG.pred_end(workNode); pred != pend; pred++) {
+                                if (nodeColor[*pred] == 0) { // the node hasn't been processed yet
+                                        nodeColor[*pred] = 1;
+                                        workList.push_back(*pred);
+                                        parent[*pred] = workNode;
                                 }
                         }
-                        //                      errs() << pb << "/" << size << "\n";
                 }
         }
         return result;
@@ -1011,19 +1142,18 @@ int llvm::Graph::getNumEdges(edgeType type){
 
 	int result = 0;
 
-    for (std::set<GraphNode*>::iterator node = nodes.begin(), end = nodes.end(); node
-                     != end; node++) {
+	const CompactGraph &CG = getCompactGraph();
 
-             std::map<GraphNode*, edgeType> succs = (*node)->getSuccessors();
+	for (unsigned ID = 0; ID < CG.getNumGraphNodes(); ++ID) {
 
-             for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(),
-                             s_end = succs.end(); succ != s_end; succ++) {
+		for (CompactGraph::edge_iterator succ = CG.succ_begin(ID), s_end = CG.succ_end(ID);
+				succ != s_end; succ++) {
 
-                     if (succ->second == type) result++;
+			if (CG.getSuccEdgeType(succ) == type) result++;
 
-             }
+		}
 
-     }
+	}
 
     return result;
 
@@ -1041,13 +1171,13 @@ std::list<GraphNode*> llvm::Graph::getNodesWithoutPredecessors() {
 
 	std::list<GraphNode*> result;
 
-    for (std::set<GraphNode*>::iterator node = nodes.begin(), end = nodes.end(); node != end; node++) {
+	const CompactGraph &CG = getCompactGraph();
 
-             std::map<GraphNode*, edgeType> preds = (*node)->getPredecessors();
+	for (unsigned ID = 0; ID < CG.getNumGraphNodes(); ++ID) {
 
-             if (preds.size() == 0) result.push_back(*node);
+		if (CG.getNumPredecessors(ID) == 0) result.push_back(CG.getNode(ID));
 
-     }
+	}
 
 	return result;
 
@@ -1055,22 +1185,30 @@ std::list<GraphNode*> llvm::Graph::getNodesWithoutPredecessors() {
 
 void llvm::Graph::removeEdge(GraphNode* src, GraphNode* dst) {
 
+	compactGraphValid = false;
+
 	src->disconnect(dst);
 
+	removeEdgeFromSCCs(src, dst);
+
 }
 
 void llvm::Graph::removeBackNodes(){
 
+	compactGraphValid = false;
+
 	for (llvm::DenseMap<GraphNode*, BackNode*>::iterator it = backNodes.begin(); it != backNodes.end(); it++){
 
 		std::map<GraphNode*, edgeType> predecessors = it->second->getPredecessors();
 		std::map<GraphNode*, edgeType>::iterator pred = predecessors.begin(), s_end = predecessors.end();
 		for (; pred != s_end; pred++) {
 
-			pred->first->connect(it->first, pred->second);
+			addEdge(pred->first, it->first, pred->second);
 
 		}
 
+		removeNodeFromSCCs(it->second);
+
 		nodes.erase(it->second);
 
 		delete it->second;
@@ -1084,6 +1222,8 @@ void llvm::Graph::removeBackNodes(){
 
 void llvm::Graph::unifyBackEdges() {
 
+	compactGraphValid = false;
+
 	if (backNodes.size()) removeBackNodes();
 
 	std::set<std::pair<GraphNode*, GraphNode*> > backEdges = getBackEdges();
@@ -1101,20 +1241,18 @@ void llvm::Graph::unifyBackEdges() {
 			nodes.insert(backNode);
 			backNodes[backEdge->second] = backNode;
 
-//			sCCs[getSCCID(backEdge->second)].insert(backNode);
-//			reverseSCCMap[backNode] = getSCCID(backEdge->second);
-
-			backNode->connect(backEdge->second);
+			addEdge(backNode, backEdge->second);
 
 		} else {
 			backNode = backNodes[backEdge->second];
 		}
 
-		backEdge->first->connect(backNode);
+		addEdge(backEdge->first, backNode);
 
 	}
 
-	recomputeSCCs();
+	//Without SCCs to update, compute them from scratch
+	if (!sCCs.size()) recomputeSCCs();
 
 }
 
@@ -1132,166 +1270,331 @@ std::set<std::pair<GraphNode*, GraphNode*> > llvm::Graph::getBackEdges(){
 }
 
 
-void llvm::Graph::strongconnect(GraphNode* node,
-		           std::map<GraphNode*, int> &index,
-		           std::map<GraphNode*, int> &lowlink,
-		           int &currentIndex,
-		           std::stack<GraphNode*> &S,
-		           std::set<GraphNode*> &S2,
-		           std::map<int, std::set<GraphNode*> > &SCCs){
+/*
+ * Iterative Tarjan's algorithm over the first numRoots nodes of CG and everything they reach.
+ * emit(rootIndex, component) is called once per SCC, in reverse topological order.
+ */
+template<class Emitter>
+static void compactTarjan(const CompactGraph &CG, unsigned numRoots, Emitter emit) {
 
+	std::vector<int> index(CG.getNumNodes(), -1), lowlink(CG.getNumNodes(), 0);
+	std::vector<char> onStack(CG.getNumNodes(), 0);
+	std::vector<unsigned> S, component;
+	std::vector<std::pair<unsigned, CompactGraph::edge_iterator> > stack;
+	int currentIndex = 0;
 
-    // Set the depth index for node to the smallest unused index
-	index[node] = currentIndex;
-    lowlink[node] = currentIndex;
-    currentIndex++;
+	for (unsigned root = 0; root < numRoots; ++root) {
 
-    S.push(node);
-    S2.insert(node);
+		if (index[root] != -1) continue;
 
-    // Consider successors of v
-	std::map<GraphNode*, edgeType> succs = node->getSuccessors();
-	for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end =
-					succs.end(); succ != s_end; succ++) {
+		index[root] = lowlink[root] = currentIndex++;
+		S.push_back(root);
+		onStack[root] = 1;
+		stack.push_back(std::make_pair(root, CG.succ_begin(root)));
 
-	       if (!index.count(succ->first)){
-	         // Successor succ has not yet been visited; recurse on it
-	        strongconnect(succ->first, index, lowlink, currentIndex, S, S2, SCCs);
-	        lowlink[node]  = min(lowlink[node], lowlink[succ->first]);
-	      } else if (S2.count(succ->first)) {
-	         // Successor w is in stack S and hence in the current SCC
-	         lowlink[node] = min(lowlink[node], index[succ->first]);
-	      }
-	}
+		while (!stack.empty()) {
 
+			unsigned ID = stack.back().first;
 
-    // If v is a root node, pop the stack and generate an SCC
-    if (lowlink[node] == index[node]){
-      //start a new strongly connected component
-    	GraphNode* w;
-    	do {
-        	w = S.top();
+			if (stack.back().second != CG.succ_end(ID)) {
 
-        	S2.erase(w);
-        	S.pop();
+				unsigned succ = *stack.back().second++;
 
-        	reverseSCCMap[w] = lowlink[node];
-        	SCCs[lowlink[node]].insert(w);
-    	} while (w != node);
-      //output the current strongly connected component
+				if (index[succ] == -1) {
+					// Successor succ has not yet been visited; descend into it
+					index[succ] = lowlink[succ] = currentIndex++;
+					S.push_back(succ);
+					onStack[succ] = 1;
+					stack.push_back(std::make_pair(succ, CG.succ_begin(succ)));
+				} else if (onStack[succ]) {
+					// Successor succ is in stack S and hence in the current SCC
+					lowlink[ID] = min(lowlink[ID], index[succ]);
+				}
 
-    }
+				continue;
+			}
+
+			stack.pop_back();
+			if (!stack.empty()) {
+				unsigned parent = stack.back().first;
+				lowlink[parent] = min(lowlink[parent], lowlink[ID]);
+			}
+
+			// If ID is a root node, pop the stack and generate an SCC
+			if (lowlink[ID] == index[ID]) {
+				component.clear();
+				unsigned w;
+				do {
+					w = S.back();
+					S.pop_back();
+					onStack[w] = 0;
+					component.push_back(w);
+				} while (w != ID);
+				emit(index[ID], component);
+			}
+		}
+	}
 
 }
 
-//SCC definition using the Tarjan's algorithm
+//SCC definition using the Tarjan's algorithm; the ID of an SCC is the DFS index of its root
 void llvm::Graph::recomputeSCCs(){
 
+	invalidateSCCs();
+
+	const CompactGraph &CG = getCompactGraph();
+
+	//Tarjan's algorithm finds the SCCs in reverse topological order
+	std::vector<int> found;
+	compactTarjan(CG, CG.getNumGraphNodes(), [&](int SCCID, const std::vector<unsigned> &component) {
+		std::set<GraphNode*> &SCC = sCCs[SCCID];
+		for (std::vector<unsigned>::const_iterator it = component.begin(); it != component.end(); ++it) {
+			GraphNode* node = CG.getNode(*it);
+			SCC.insert(node);
+			reverseSCCMap[node] = SCCID;
+		}
+		found.push_back(SCCID);
+	});
+
+	sccOrder.assign(found.rbegin(), found.rend());
+	for (unsigned slot = 0; slot < sccOrder.size(); ++slot) sccSlot[sccOrder[slot]] = slot;
+
+	nextSCCID = CG.getNumNodes();
+
+}
+
+void llvm::Graph::invalidateSCCs(){
+
 	sCCs.clear();
 	reverseSCCMap.clear();
-	topologicalOrderedSCCs.clear();
+	sccOrder.clear();
+	sccSlot.clear();
 
-	int currentIndex = 0;
-	std::map<GraphNode*, int> index;
-	std::map<GraphNode*, int> lowlink;
+}
 
-	std::stack<GraphNode*> S;
-	std::set<GraphNode*> S2;
+void llvm::Graph::addNodeToSCCs(GraphNode* node){
 
-	for (std::set<GraphNode*>::iterator node = nodes.begin(), end = nodes.end(); node != end; node++) {
+	if (!sCCs.size() || reverseSCCMap.count(node)) return;
 
-		if(!index.count(*node)){
-			strongconnect(*node, index, lowlink, currentIndex, S, S2, sCCs);
-		}
+	//A new node is an SCC by itself, and it may go anywhere in the order
+	int SCCID = nextSCCID++;
+	sCCs[SCCID].insert(node);
+	reverseSCCMap[node] = SCCID;
+	sccSlot[SCCID] = sccOrder.size();
+	sccOrder.push_back(SCCID);
+
+}
+
+//Collects the SCCs reachable from (or, backwards, reaching) SCCID whose slots lie in [lower, upper]
+void llvm::Graph::collectSCCs(int SCCID, unsigned lower, unsigned upper, bool forward, std::set<int> &result){
+
+	std::vector<int> worklist(1, SCCID);
+	result.insert(SCCID);
+
+	while (!worklist.empty()) {
+
+		int current = worklist.back();
+		worklist.pop_back();
+
+		const std::set<GraphNode*> &SCC = sCCs[current];
+		for (std::set<GraphNode*>::const_iterator node = SCC.begin(); node != SCC.end(); ++node) {
+
+			const std::map<GraphNode*, edgeType> &edges = forward ? (*node)->getSuccessors() : (*node)->getPredecessors();
+			for (std::map<GraphNode*, edgeType>::const_iterator edge = edges.begin(); edge != edges.end(); ++edge) {
+
+				std::map<GraphNode*, int>::iterator next = reverseSCCMap.find(edge->first);
+				if (next == reverseSCCMap.end() || result.count(next->second)) continue;
+
+				unsigned slot = sccSlot[next->second];
+				if (slot < lower || slot > upper) continue;
 
+				result.insert(next->second);
+				worklist.push_back(next->second);
+			}
+		}
 	}
 
 }
 
-void llvm::Graph::dumpSCCs(){
+/*
+ * An edge inside an SCC, or that follows the topological order, changes nothing. An edge against
+ * the order only affects the SCCs placed between its ends (Pearce-Kelly): the ones that reach src
+ * move before the ones reachable from dst, and those in both sets now form a single SCC.
+ */
+void llvm::Graph::addEdgeToSCCs(GraphNode* src, GraphNode* dst){
 
-	errs() << "\nSCCs\n";
-	for(std::map<int, std::set<GraphNode*> >::iterator it = sCCs.begin(); it != sCCs.end(); it++){
-		errs() << "SCC[" << it->first << "] : " << it->second.size() << " nodes\n"  ;
+	if (!sCCs.size()) return;
+
+	addNodeToSCCs(src);
+	addNodeToSCCs(dst);
+
+	int srcSCC = reverseSCCMap[src], dstSCC = reverseSCCMap[dst];
+	if (srcSCC == dstSCC || sccSlot[srcSCC] < sccSlot[dstSCC]) return;
+
+	unsigned lower = sccSlot[dstSCC], upper = sccSlot[srcSCC];
+
+	std::set<int> forward, backward;
+	collectSCCs(dstSCC, lower, upper, true, forward);
+	collectSCCs(srcSCC, lower, upper, false, backward);
+
+	bool cycle = forward.count(srcSCC);
+
+	//Slots of the affected SCCs, and the SCCs that keep their identity, ordered by slot
+	std::vector<unsigned> slots;
+	std::map<unsigned, int> before, after;
+
+	for (std::set<int>::iterator it = backward.begin(); it != backward.end(); ++it) {
+		slots.push_back(sccSlot[*it]);
+		if (!forward.count(*it)) before[sccSlot[*it]] = *it;
 	}
 
-	errs() << "\nNodes\n";
-	for(std::map<GraphNode*, int>::iterator it = reverseSCCMap.begin(); it != reverseSCCMap.end(); it++){
-		errs() << "Node[" << it->first->getLabel() << "] : SCC " << it->second << "\n"  ;
+	for (std::set<int>::iterator it = forward.begin(); it != forward.end(); ++it) {
+		if (backward.count(*it)) continue;
+		slots.push_back(sccSlot[*it]);
+		after[sccSlot[*it]] = *it;
 	}
 
-}
+	std::sort(slots.begin(), slots.end());
 
-std::map<int, std::set<GraphNode*> > llvm::Graph::getSCCs(){
+	//Merge the SCCs of the new cycle into the SCC of dst
+	if (cycle) {
 
-	if(!sCCs.size()) {
+		std::set<GraphNode*> &merged = sCCs[dstSCC];
+		for (std::set<int>::iterator it = forward.begin(); it != forward.end(); ++it) {
 
-		recomputeSCCs();
+			if (*it == dstSCC || !backward.count(*it)) continue;
+
+			std::set<GraphNode*> &SCC = sCCs[*it];
+			for (std::set<GraphNode*>::iterator node = SCC.begin(); node != SCC.end(); ++node) {
+				merged.insert(*node);
+				reverseSCCMap[*node] = dstSCC;
+			}
+
+			sCCs.erase(*it);
+			sccSlot.erase(*it);
+		}
+	}
+
+	//SCCs only move towards their side of the range; merged SCCs leave free slots in the middle
+	std::vector<int> reordered;
+	for (std::map<unsigned, int>::iterator it = before.begin(); it != before.end(); ++it) reordered.push_back(it->second);
+	reordered.resize(slots.size() - after.size() - cycle, -1);
+	if (cycle) reordered.push_back(dstSCC);
+	for (std::map<unsigned, int>::iterator it = after.begin(); it != after.end(); ++it) reordered.push_back(it->second);
+
+	for (unsigned i = 0; i < slots.size(); ++i) {
+		sccOrder[slots[i]] = reordered[i];
+		if (reordered[i] != -1) sccSlot[reordered[i]] = slots[i];
 	}
 
-	return sCCs;
 }
 
-std::list<int> llvm::Graph::getSCCTopologicalOrder(){
+//Removing an edge between two SCCs keeps them and their order valid; inside an SCC it may break it
+void llvm::Graph::removeEdgeFromSCCs(GraphNode* src, GraphNode* dst){
 
-	if (!topologicalOrderedSCCs.size()) {
+	if (!sCCs.size() || !reverseSCCMap.count(src) || !reverseSCCMap.count(dst)) return;
 
-		recomputeSCCs();
+	if (reverseSCCMap[src] == reverseSCCMap[dst]) splitSCC(reverseSCCMap[src]);
 
-		GenericGraph<int> dagSCC;
+}
 
-		//Step 1: Build SCC DAG
-		std::map<int, std::set<GraphNode*> >  localSCCs = getSCCs();
+//Must be called before the node is deleted
+void llvm::Graph::removeNodeFromSCCs(GraphNode* node){
 
-		//For each SCC....
-		for (std::map<int, std::set<GraphNode*> >::iterator it = localSCCs.begin(); it != localSCCs.end(); it++){
+	if (!sCCs.size()) return;
 
-			int currentSCC = it->first;
+	std::map<GraphNode*, int>::iterator entry = reverseSCCMap.find(node);
+	if (entry == reverseSCCMap.end()) return;
 
-			GenericGraphNode<int>* currentSCCNode = dagSCC.addNode(currentSCC);
+	int SCCID = entry->second;
+	reverseSCCMap.erase(entry);
+	sCCs[SCCID].erase(node);
 
-			//... iterate over its nodes...
-			for ( std::set<GraphNode*>::iterator node = it->second.begin(); node != it->second.end(); node++ ){
-				GraphNode* currentNode = *node;
+	if (sCCs[SCCID].size()) {
+		splitSCC(SCCID);
+	} else {
+		sccOrder[sccSlot[SCCID]] = -1;
+		sccSlot.erase(SCCID);
+		sCCs.erase(SCCID);
+	}
 
-				//... and create edges to the SCCs of the successors
-				std::map<GraphNode*, edgeType> successors = currentNode->getSuccessors();
-				for (std::map<GraphNode*, edgeType>::iterator succ = successors.begin(); succ != successors.end(); succ++){
+}
 
-					GraphNode* succNode = succ->first;
-					int succSCC = getSCCID(succNode);
+//Recomputes the SCCs among the nodes of SCCID, which take its place in the topological order
+void llvm::Graph::splitSCC(int SCCID){
 
-					// It's a DAG. No self loops!
-					if (currentSCC != succSCC) {
-						GenericGraphNode<int>* succSCCNode = dagSCC.addNode(succSCC);
-						dagSCC.addEdge(currentSCCNode, succSCCNode, 1);
-					}
+	if (sCCs[SCCID].size() < 2) return;
 
-				}
+	CompactGraph CG(sCCs[SCCID], true);
 
-			}
+	std::vector<std::vector<unsigned> > components;
+	compactTarjan(CG, CG.getNumNodes(), [&](int, const std::vector<unsigned> &component) {
+		components.push_back(component);
+	});
+
+	if (components.size() == 1) return;
+
+	//Components come in reverse topological order; the first one in the order keeps the ID
+	std::vector<int> pieces;
+	for (std::vector<std::vector<unsigned> >::reverse_iterator it = components.rbegin(); it != components.rend(); ++it) {
+
+		int pieceID = pieces.size() ? nextSCCID++ : SCCID;
 
+		std::set<GraphNode*> piece;
+		for (std::vector<unsigned>::iterator ID = it->begin(); ID != it->end(); ++ID) {
+			GraphNode* node = CG.getNode(*ID);
+			piece.insert(node);
+			reverseSCCMap[node] = pieceID;
 		}
 
-		assert (localSCCs.size() == dagSCC.getNumNodes() && "DAG of SCCs have a wrong number of nodes");
+		sCCs[pieceID] = piece;
+		pieces.push_back(pieceID);
+	}
 
-		//Step 2: Compute topological order (greedy algorithm)
-		while ( dagSCC.getNumNodes() > 0  ) {
+	unsigned slot = sccSlot[SCCID];
+	sccOrder.erase(sccOrder.begin() + slot);
+	sccOrder.insert(sccOrder.begin() + slot, pieces.begin(), pieces.end());
 
-			GenericGraphNode<int>* currentNode = dagSCC.getFirstNodeWithoutPredecessors();
+	for (unsigned i = slot; i < sccOrder.size(); ++i) {
+		if (sccOrder[i] != -1) sccSlot[sccOrder[i]] = i;
+	}
 
-			assert(currentNode && "DAG of SCCs have a cycle (it is not a valid DAG)!");
+}
 
-			int SCCID = **currentNode;
+void llvm::Graph::dumpSCCs(){
 
-			topologicalOrderedSCCs.push_back(SCCID);
+	errs() << "\nSCCs\n";
+	for(std::map<int, std::set<GraphNode*> >::iterator it = sCCs.begin(); it != sCCs.end(); it++){
+		errs() << "SCC[" << it->first << "] : " << it->second.size() << " nodes\n"  ;
+	}
 
-			dagSCC.removeNode(currentNode);
-		}
+	errs() << "\nNodes\n";
+	for(std::map<GraphNode*, int>::iterator it = reverseSCCMap.begin(); it != reverseSCCMap.end(); it++){
+		errs() << "Node[" << it->first->getLabel() << "] : SCC " << it->second << "\n"  ;
+	}
 
+}
+
+std::map<int, std::set<GraphNode*> > llvm::Graph::getSCCs(){
+
+	if(!sCCs.size()) {
+
+		recomputeSCCs();
 	}
 
-	return topologicalOrderedSCCs;
+	return sCCs;
+}
+
+std::list<int> llvm::Graph::getSCCTopologicalOrder(){
+
+	if (!sCCs.size()) recomputeSCCs();
+
+	std::list<int> result;
+	for (std::vector<int>::iterator it = sccOrder.begin(); it != sccOrder.end(); ++it) {
+		if (*it != -1) result.push_back(*it);
+	}
+
+	return result;
 }
 
 int llvm::Graph::getSCCID(GraphNode* node) {
@@ -1335,154 +1638,292 @@ std::set<GraphNode*> llvm::Graph::getSCC(int ID) {
 
 
 /*
- * getAcyclicPaths - Returns a list of acyclic paths (hamiltonian paths)
- * from a source node to a destination node.
- *
- * This method implements a modified breadth-first search to collect the
- * paths using a backtracking strategy
+ * Class AcyclicPathEnumerator
  */
-void llvm::Graph::getAcyclicPaths_rec(
-		                 GraphNode* dst,
-		                 std::set<GraphNode*> &visitedNodes,
-		                 std::stack<GraphNode*> &path,
-		                 std::set<std::stack<GraphNode*> > &result,
-		                 int SCCID) {
+llvm::AcyclicPathEnumerator::AcyclicPathEnumerator(const std::set<GraphNode*> &nodes, GraphNode* from, GraphNode* to) :
+	CG(nodes, true), src(CG.getNodeID(from)), dst(CG.getNodeID(to)), onPath(CG.getNumNodes(), 0),
+	started(false), reached(CG.getNumNodes(), 0), stamp(0) {
+}
 
-	GraphNode* u = path.top();
+//Whether dst can be reached from ID without going through the nodes on the current path
+bool llvm::AcyclicPathEnumerator::canReachDst(unsigned ID) {
 
-	std::map<GraphNode*, edgeType> succs = u->getSuccessors();
-	for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end =
-					succs.end(); succ != s_end; succ++) {
+	if (++stamp == 0) {
+		std::fill(reached.begin(), reached.end(), 0);
+		stamp = 1;
+	}
 
-		if(succ->first == dst){
-			path.push(dst);
+	std::vector<unsigned> worklist(1, ID);
+	reached[ID] = stamp;
 
-			result.insert(path);
+	while (!worklist.empty()) {
 
-			//truncating number of paths
-			if (result.size() >= 1000) return;
+		unsigned current = worklist.back();
+		worklist.pop_back();
 
-			//errs() << "SCC:	"<< SCCID<<"	New Path:" << result.size() << "\n";
-			path.pop();
-			break;
+		for (CompactGraph::edge_iterator succ = CG.succ_begin(current), s_end = CG.succ_end(current); succ != s_end; ++succ) {
+			if ((int)*succ == dst) return true;
+			if (onPath[*succ] || reached[*succ] == stamp) continue;
+			reached[*succ] = stamp;
+			worklist.push_back(*succ);
 		}
 	}
 
-	if (result.size() >= 1000) return;
+	return false;
+}
 
-	// in breadth-first, recursion needs to come after visiting adjacent nodes
-	for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end =
-					succs.end(); succ != s_end; succ++) {
+bool llvm::AcyclicPathEnumerator::next(std::vector<GraphNode*> &result) {
 
-		if (result.size() >= 1000) return;
+	if (!started) {
+		started = true;
+		if (src == -1 || dst == -1) return false;
+		path.push_back(src);
+		nextSucc.push_back(0);
+		onPath[src] = 1;
+	}
 
-		if (visitedNodes.count(succ->first) != 0 && succ->first != dst) continue;
+	//Depth-first search with an explicit stack, resumed where the last path was found
+	while (!path.empty()) {
 
+		unsigned ID = path.back();
 
-		if (SCCID == -1 || SCCID == getSCCID(succ->first)) {
+		if (nextSucc.back() == CG.getNumSuccessors(ID)) {
+			onPath[ID] = 0;
+			path.pop_back();
+			nextSucc.pop_back();
+			continue;
+		}
 
-			//Pruning
-			if (!acyclicPathExists(succ->first, dst, visitedNodes, SCCID)) continue;
+		unsigned succ = CG.succ_begin(ID)[nextSucc.back()++];
 
+		if ((int)succ == dst) {
+			result.clear();
+			for (std::vector<unsigned>::iterator it = path.begin(); it != path.end(); ++it)
+				result.push_back(CG.getNode(*it));
+			result.push_back(CG.getNode(succ));
+			return true;
+		}
 
-			visitedNodes.insert(succ->first);
-			path.push(succ->first);
+		if (onPath[succ] || !canReachDst(succ)) continue;
 
-			getAcyclicPaths_rec(dst, visitedNodes, path, result, SCCID);
+		path.push_back(succ);
+		nextSucc.push_back(0);
+		onPath[succ] = 1;
+	}
 
-			//truncating number of paths
-			if (result.size() >= 1000) return;
+	return false;
+}
 
-			visitedNodes.erase(succ->first);
-			path.pop();
+/*
+ * Path queries
+ */
 
-		}
-	}
-}
+//A nested loop is a cycle reachable from first that does not go through first
+bool Graph::hasNestedLoop(GraphNode* first){
 
+	const CompactGraph &CG = getCompactGraph();
+	int start = CG.getNodeID(first);
+	if (start == -1) return false;
 
-std::set<std::stack<GraphNode*> > llvm::Graph::getAcyclicPaths(GraphNode* src,
-		GraphNode* dst) {
+	std::set<GraphNode*> reachable;
+	std::vector<char> seen(CG.getNumNodes(), 0);
+	compactDFS(CG, start, false, seen, [&](unsigned ID) {
+		if ((int)ID != start) reachable.insert(CG.getNode(ID));
+	});
 
-	std::set<std::stack<GraphNode*> > result;
+	CompactGraph subGraph(reachable, true);
 
-	std::set<GraphNode*> visitedNodes;
-	std::stack<GraphNode*> path;
+	bool found = false;
+	compactTarjan(subGraph, subGraph.getNumNodes(), [&](int, const std::vector<unsigned> &component) {
+		if (component.size() > 1) found = true;
+		else if (std::count(subGraph.succ_begin(component[0]), subGraph.succ_end(component[0]), component[0])) found = true;
+	});
 
-	visitedNodes.insert(src);
-	path.push(src);
+	return found;
+}
 
-	getAcyclicPaths_rec(dst, visitedNodes, path, result, -1);
+bool Graph::hasNestedLoop(int SCCID){
+	std::set<GraphNode*> SCC = getSCC(SCCID);
+	GraphNode* first = *(SCC.begin());
+	return hasNestedLoop(first);
+}
 
-	return result;
+AcyclicPathEnumerator llvm::Graph::enumerateAcyclicPaths(GraphNode* src, GraphNode* dst, bool insideSCC) {
 
+	if (insideSCC) return AcyclicPathEnumerator(getSCC(getSCCID(src)), src, dst);
 
+	return AcyclicPathEnumerator(nodes, src, dst);
 }
 
+unsigned llvm::Graph::countAcyclicPaths(GraphNode* src, GraphNode* dst, bool insideSCC, unsigned limit) {
+
+	AcyclicPathEnumerator paths = enumerateAcyclicPaths(src, dst, insideSCC);
 
-std::set<std::stack<GraphNode*> > llvm::Graph::getAcyclicPathsInsideSCC(GraphNode* src, GraphNode* dst){
+	std::vector<GraphNode*> path;
+	unsigned count = 0;
+	while (count < limit && paths.next(path)) count++;
+
+	return count;
+}
 
+static std::set<std::stack<GraphNode*> > collectAcyclicPaths(AcyclicPathEnumerator paths, unsigned limit) {
 
 	std::set<std::stack<GraphNode*> > result;
 
-	std::set<GraphNode*> visitedNodes;
-	std::stack<GraphNode*> path;
+	std::vector<GraphNode*> path;
+	while (result.size() < limit && paths.next(path)) {
+		std::stack<GraphNode*> stack;
+		for (std::vector<GraphNode*>::iterator it = path.begin(); it != path.end(); ++it) stack.push(*it);
+		result.insert(stack);
+	}
 
-	visitedNodes.insert(src);
-	path.push(src);
+	return result;
+}
 
-	int SCCID = getSCCID(src);
+std::set<std::stack<GraphNode*> > llvm::Graph::getAcyclicPaths(GraphNode* src, GraphNode* dst, unsigned limit) {
 
-	getAcyclicPaths_rec(dst, visitedNodes, path, result, SCCID);
+	return collectAcyclicPaths(enumerateAcyclicPaths(src, dst, false), limit);
 
-	return result;
 }
 
-bool Graph::acyclicPathExists(GraphNode* src,
-		GraphNode* dst,
-        std::set<GraphNode*> visitedNodes,
-        int SCCID){
+std::set<std::stack<GraphNode*> > llvm::Graph::getAcyclicPathsInsideSCC(GraphNode* src, GraphNode* dst, unsigned limit){
+
+	return collectAcyclicPaths(enumerateAcyclicPaths(src, dst, true), limit);
 
-	std::set<GraphNode*> worklist;
-	worklist.insert(src);
+}
 
-	while(worklist.size()){
+uint64_t llvm::Graph::countCondensationPaths(GraphNode* src, GraphNode* dst) {
 
-		GraphNode* current = *worklist.begin();
-		worklist.erase(current);
+	int srcSCC = getSCCID(src), dstSCC = getSCCID(dst);
+	if (srcSCC == -1 || dstSCC == -1) return 0;
 
-		if (current==dst) return true;
+	//Number of paths from srcSCC to each SCC, in topological order
+	std::map<int, uint64_t> paths;
+	paths[srcSCC] = 1;
 
-		if (visitedNodes.count(current)) {
+	std::list<int> order = getSCCTopologicalOrder();
+	for (std::list<int>::iterator it = order.begin(); it != order.end(); ++it) {
 
-			//Item that have just been popped from the worklist and have already been visited
-			errs() << "ERROR! "<< current->getLabel() <<"\n";
-			continue;
+		if (*it == dstSCC) break;
 
+		std::map<int, uint64_t>::iterator current = paths.find(*it);
+		if (current == paths.end()) continue;
+
+		//Parallel edges between two SCCs make a single edge of the DAG
+		std::set<int> succSCCs;
+		const std::set<GraphNode*> &SCC = sCCs[*it];
+		for (std::set<GraphNode*>::const_iterator node = SCC.begin(); node != SCC.end(); ++node) {
+			const std::map<GraphNode*, edgeType> &succs = (*node)->getSuccessors();
+			for (std::map<GraphNode*, edgeType>::const_iterator succ = succs.begin(); succ != succs.end(); ++succ) {
+				std::map<GraphNode*, int>::iterator succSCC = reverseSCCMap.find(succ->first);
+				if (succSCC != reverseSCCMap.end() && succSCC->second != *it) succSCCs.insert(succSCC->second);
+			}
 		}
-		visitedNodes.insert(current);
 
-	    std::map<GraphNode*, edgeType> succs = current->getSuccessors();
+		for (std::set<int>::iterator succSCC = succSCCs.begin(); succSCC != succSCCs.end(); ++succSCC) {
+			uint64_t &count = paths[*succSCC];
+			count = count > UINT64_MAX - current->second ? UINT64_MAX : count + current->second;
+		}
+	}
 
-	    for (std::map<GraphNode*, edgeType>::iterator succ = succs.begin(), s_end =
-	                    succs.end(); succ != s_end; succ++) {
+	return paths.count(dstSCC) ? paths[dstSCC] : 0;
+}
 
+/*
+ * Breadth-first search for the shortest path (of at least one edge) from src to dst that
+ * avoids the banned nodes and edges. dst is never banned.
+ */
+static bool compactShortestPath(const CompactGraph &CG, unsigned src, unsigned dst,
+		const std::vector<char> &bannedNodes, const std::set<std::pair<unsigned, unsigned> > &bannedEdges,
+		std::vector<unsigned> &path) {
 
-	    	if (visitedNodes.count(succ->first) && succ->first != dst) continue;
-	    	if (worklist.count(succ->first)) continue;
+	std::vector<int> parent(CG.getNumNodes(), -1);
+	std::vector<unsigned> queue(1, src);
 
+	for (unsigned head = 0; head < queue.size(); ++head) {
 
-			if(SCCID == -1 || SCCID == getSCCID(succ->first)){
+		unsigned ID = queue[head];
 
-				//Only insert in the worklist items that have not been visited yet
-				worklist.insert(succ->first);
+		for (CompactGraph::edge_iterator succ = CG.succ_begin(ID), s_end = CG.succ_end(ID); succ != s_end; ++succ) {
 
+			if (bannedEdges.count(std::make_pair(ID, *succ))) continue;
+
+			if (*succ == dst) {
+				path.assign(1, dst);
+				for (int node = ID; node != -1; node = node == (int)src ? -1 : parent[node])
+					path.push_back(node);
+				std::reverse(path.begin(), path.end());
+				return true;
 			}
-	    }
+
+			if (*succ == src || bannedNodes[*succ] || parent[*succ] != -1) continue;
+
+			parent[*succ] = ID;
+			queue.push_back(*succ);
+		}
 	}
 
 	return false;
+}
+
+std::vector<std::vector<GraphNode*> > llvm::Graph::getShortestPaths(GraphNode* src, GraphNode* dst, unsigned k, bool insideSCC) {
+
+	std::vector<std::vector<GraphNode*> > result;
+
+	CompactGraph SCCGraph;
+	if (insideSCC) SCCGraph = CompactGraph(getSCC(getSCCID(src)), true);
+	const CompactGraph &CG = insideSCC ? SCCGraph : getCompactGraph();
+
+	int from = CG.getNodeID(src), to = CG.getNodeID(dst);
+	if (from == -1 || to == -1 || !k) return result;
 
+	std::vector<char> bannedNodes(CG.getNumNodes(), 0);
+	std::set<std::pair<unsigned, unsigned> > bannedEdges;
+
+	std::vector<std::vector<unsigned> > shortest(1);
+	if (!compactShortestPath(CG, from, to, bannedNodes, bannedEdges, shortest[0])) return result;
+
+	//Candidates, ordered by length
+	std::set<std::pair<unsigned, std::vector<unsigned> > > candidates;
+
+	while (shortest.size() < k) {
+
+		const std::vector<unsigned> last = shortest.back();
+
+		//Deviate from the last path at each of its nodes
+		for (unsigned i = 0; i + 1 < last.size(); ++i) {
+
+			bannedEdges.clear();
+			for (std::vector<std::vector<unsigned> >::iterator p = shortest.begin(); p != shortest.end(); ++p) {
+				if (p->size() > i + 1 && std::equal(last.begin(), last.begin() + i + 1, p->begin()))
+					bannedEdges.insert(std::make_pair((*p)[i], (*p)[i + 1]));
+			}
+
+			std::fill(bannedNodes.begin(), bannedNodes.end(), 0);
+			for (unsigned j = 0; j < i; ++j) bannedNodes[last[j]] = 1;
+			bannedNodes[to] = 0;
+
+			std::vector<unsigned> spur;
+			if (!compactShortestPath(CG, last[i], to, bannedNodes, bannedEdges, spur)) continue;
+
+			std::vector<unsigned> candidate(last.begin(), last.begin() + i);
+			candidate.insert(candidate.end(), spur.begin(), spur.end());
+			candidates.insert(std::make_pair((unsigned)candidate.size(), candidate));
+		}
+
+		if (candidates.empty()) break;
+
+		shortest.push_back(candidates.begin()->second);
+		candidates.erase(candidates.begin());
+	}
+
+	for (std::vector<std::vector<unsigned> >::iterator p = shortest.begin(); p != shortest.end(); ++p) {
+		result.push_back(std::vector<GraphNode*>());
+		for (std::vector<unsigned>::iterator ID = p->begin(); ID != p->end(); ++ID)
+			result.back().push_back(CG.getNode(*ID));
+	}
+
+	return result;
 }
 
 //*********************************************************************************************************************************************************************
@@ -1504,6 +1945,14 @@ void functionDepGraph::getAnalysisUsage(AnalysisUsage &AU) const {
 	AU.setPreservesAll();
 }
 
+bool functionDepGraph::doInitialization(Module &M) {
+
+        if (!depGraphCache.empty())
+                Graph::hashModule(M, moduleHash);
+
+        return false;
+}
+
 bool functionDepGraph::runOnFunction(Function &F) {
 
         AliasSets* AS = NULL;
@@ -1511,6 +1960,20 @@ bool functionDepGraph::runOnFunction(Function &F) {
         if (USE_ALIAS_SETS)
                 AS = &(getAnalysis<AliasSets> ());
 
+        //Reuse the graph saved by a previous run on the same function
+        std::string cacheFile;
+        if (!depGraphCache.empty()) {
+                cacheFile = depGraphCache + "." + F.getName().str();
+                for (unsigned i = depGraphCache.size() + 1; i < cacheFile.size(); ++i)
+                        if (!isalnum(cacheFile[i]) && cacheFile[i] != '_' && cacheFile[i] != '.')
+                                cacheFile[i] = '_';
+
+                depGraph = new Graph(AS);
+                if (depGraph->readFromFile(cacheFile, F, moduleHash))
+                        return false;
+                delete depGraph;
+        }
+
         //Making dependency graph
         depGraph = new Graph(AS);
         //Insert instructions in the graph
@@ -1521,6 +1984,12 @@ bool functionDepGraph::runOnFunction(Function &F) {
                 }
         }
 
+        if (!cacheFile.empty()) {
+                depGraph->recomputeSCCs();
+                if (!depGraph->writeToFile(cacheFile, F, moduleHash))
+                        errs() << "Could not save the DepGraph to " << cacheFile << "\n";
+        }
+
         //We don't modify anything, so we must return false
         return false;
 }
@@ -1545,18 +2014,60 @@ bool moduleDepGraph::runOnModule(Module &M) {
         if (USE_ALIAS_SETS)
                 AS = &(getAnalysis<AliasSets> ());
 
+        //Reuse the graph saved by a previous run on the same module
+        if (!depGraphCache.empty()) {
+                depGraph = new Graph(AS);
+                if (depGraph->readFromFile(depGraphCache, M))
+                        return false;
+                delete depGraph;
+        }
+
+        //Each function gets a graph of its own, built in parallel, which are then merged
+        //in module order. Graphs are created up front: their constructor resets NrEdges.
+        //Nodes come from the heap rather than from a per-graph arena: graphs are copied by
+        //value (makeSubGraph), single nodes are deleted as the graph is edited and the
+        //nodes outlive their graph, so mergeGraph hands the node pointers over instead
+        std::vector<Function*> functions;
+        std::vector<Graph*> functionGraphs;
+        for (Module::iterator Fit = M.begin(), Fend = M.end(); Fit != Fend; ++Fit) {
+                if (Fit->begin() == Fit->end())
+                        continue;
+                functions.push_back(Fit);
+                functionGraphs.push_back(new Graph(AS));
+        }
+
         //Making dependency graph
         depGraph = new Graph(AS);
 
-        //Insert instructions in the graph
-        for (Module::iterator Fit = M.begin(), Fend = M.end(); Fit != Fend; ++Fit) {
-                for (Function::iterator BBit = Fit->begin(), BBend = Fit->end(); BBit
-                                != BBend; ++BBit) {
-                        for (BasicBlock::iterator Iit = BBit->begin(), Iend = BBit->end(); Iit
-                                        != Iend; ++Iit) {
-                                depGraph->addInst(Iit);
+        //Workers only read the IR and the alias sets, and write to their own graphs
+        std::atomic<unsigned> nextFunction(0);
+        auto buildGraphs = [&]() {
+                for (unsigned i = nextFunction++; i < functions.size(); i = nextFunction++) {
+                        Graph* G = functionGraphs[i];
+                        for (Function::iterator BBit = functions[i]->begin(), BBend = functions[i]->end(); BBit
+                                        != BBend; ++BBit) {
+                                for (BasicBlock::iterator Iit = BBit->begin(), Iend = BBit->end(); Iit
+                                                != Iend; ++Iit) {
+                                        G->addInst(Iit);
+                                }
                         }
                 }
+        };
+
+        unsigned numThreads = depGraphThreads ? (unsigned)depGraphThreads : std::thread::hardware_concurrency();
+        numThreads = std::max(1u, std::min(numThreads, (unsigned)functions.size()));
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < numThreads; ++i)
+                workers.push_back(std::thread(buildGraphs));
+        buildGraphs();
+        for (unsigned i = 0; i < workers.size(); ++i)
+                workers[i].join();
+
+        //Stitch the function graphs together; call sites are linked to formals and returns below
+        for (unsigned i = 0; i < functionGraphs.size(); ++i) {
+                depGraph->mergeGraph(*functionGraphs[i]);
+                delete functionGraphs[i];
         }
 
         //Connect formal and actual parameters and return values
@@ -1571,6 +2082,13 @@ bool moduleDepGraph::runOnModule(Module &M) {
 
         }
 
+        //The SCCs are saved as well, so that clients that load the graph get them for free
+        if (!depGraphCache.empty()) {
+                depGraph->recomputeSCCs();
+                if (!depGraph->writeToFile(depGraphCache, M))
+                        errs() << "Could not save the DepGraph to " << depGraphCache << "\n";
+        }
+
         //We don't modify anything, so we must return false
         return false;
 }
@@ -1687,6 +2205,398 @@ void llvm::moduleDepGraph::deleteCallNodes(Function* F) {
         depGraph->deleteCallNodes(F);
 }
 
+/*
+ * Binary serialization of the graph
+ *
+ * The file holds a header, one record per node, one record per edge and the SCCs in
+ * topological order. Records are plain 32-bit integers in host byte order, so a file can
+ * be read straight from the mapped buffer. Values are identified by their position in a
+ * walk over the module, which only stays valid for the module the file was written for:
+ * the header carries an MD5 of the printed module, and files of any other module, of
+ * another format version or built with other options are rejected.
+ * The graph of a single function is keyed on that function instead: the walk only covers
+ * its body, and the hash covers its text and the hash of the module, which the pass
+ * computes once in doInitialization rather than once per function.
+ */
+namespace {
+
+const char DepGraphFileMagic[8] = {'D', 'E', 'P', 'G', 'R', 'A', 'P', 'H'};
+const uint32_t DepGraphFileVersion = 1;
+
+enum DepGraphFileFlags {
+	dgfAliasSets = 1,
+	dgfAllInsts = 2,
+	dgfFunction = 4					//The file holds the graph of a single function
+};
+
+struct DepGraphFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint8_t moduleHash[16];
+	uint32_t numValues;				//Size of the value numbering, as a sanity check
+	uint32_t numNodes;
+	uint32_t numEdges;
+	uint32_t numSCCs;				//Zero if the SCCs were not computed
+};
+
+struct DepGraphNodeRecord {
+	uint32_t kind;					//Class ID of the node
+	uint32_t opCode;
+	int32_t value;					//Value number; alias set ID for memory nodes, next node for back nodes
+	int32_t SCCID;
+};
+
+struct DepGraphEdgeRecord {
+	uint32_t src;
+	uint32_t dst;
+	uint32_t type;
+};
+
+}
+
+static uint32_t getDepGraphFileFlags(bool function) {
+	return (USE_ALIAS_SETS ? dgfAliasSets : 0) | (includeAllInstsInDepGraph ? dgfAllInsts : 0) |
+			(function ? dgfFunction : 0);
+}
+
+void llvm::Graph::hashModule(Module &M, MD5::MD5Result &result) {
+
+	std::string text;
+	raw_string_ostream stream(text);
+	M.print(stream, NULL);
+	stream.flush();
+
+	MD5 hash;
+	hash.update(text);
+	hash.final(result);
+}
+
+//Hashes the printed function together with the hash of its module: alias sets are computed
+//over the whole module, so the graph of F depends on more than its own text
+static void hashFunction(Function &F, const MD5::MD5Result &moduleHash, MD5::MD5Result &result) {
+
+	std::string text;
+	raw_string_ostream stream(text);
+	F.print(stream, NULL);
+	stream.flush();
+
+	MD5 hash;
+	hash.update(ArrayRef<uint8_t>(moduleHash, sizeof(MD5::MD5Result)));
+	hash.update(text);
+	hash.final(result);
+}
+
+static void numberValue(Value *v, std::vector<Value*> &values, DenseMap<Value*, int> &IDs) {
+	if (IDs.insert(std::make_pair(v, (int)values.size())).second) values.push_back(v);
+}
+
+//Numbers F, its arguments, blocks, instructions and operands, in function order. Globals and
+//functions are numbered where they are first used, so the numbering only depends on F
+static void numberFunctionValues(Function &F, std::vector<Value*> &values, DenseMap<Value*, int> &IDs) {
+
+	numberValue(&F, values, IDs);
+
+	for (Function::arg_iterator A = F.arg_begin(), AE = F.arg_end(); A != AE; ++A)
+		numberValue(A, values, IDs);
+
+	for (Function::iterator BB = F.begin(), BBE = F.end(); BB != BBE; ++BB) {
+		numberValue(BB, values, IDs);
+		for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+			numberValue(I, values, IDs);
+			for (unsigned i = 0; i < I->getNumOperands(); ++i)
+				numberValue(I->getOperand(i), values, IDs);
+		}
+	}
+}
+
+//Numbers every global of M, then every function and its body, in module order
+static void numberModuleValues(Module &M, std::vector<Value*> &values, DenseMap<Value*, int> &IDs) {
+
+	for (Module::global_iterator G = M.global_begin(), E = M.global_end(); G != E; ++G)
+		numberValue(G, values, IDs);
+
+	for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+		numberFunctionValues(*F, values, IDs);
+}
+
+bool llvm::Graph::writeToFile(StringRef fileName, Module &M) {
+
+	std::vector<Value*> values;
+	DenseMap<Value*, int> valueIDs;
+	numberModuleValues(M, values, valueIDs);
+
+	MD5::MD5Result hash;
+	hashModule(M, hash);
+
+	return writeFile(fileName, valueIDs, values.size(), hash, getDepGraphFileFlags(false));
+}
+
+bool llvm::Graph::writeToFile(StringRef fileName, Function &F, const MD5::MD5Result &moduleHash) {
+
+	std::vector<Value*> values;
+	DenseMap<Value*, int> valueIDs;
+	numberFunctionValues(F, values, valueIDs);
+
+	MD5::MD5Result hash;
+	hashFunction(F, moduleHash, hash);
+
+	return writeFile(fileName, valueIDs, values.size(), hash, getDepGraphFileFlags(true));
+}
+
+bool llvm::Graph::readFromFile(StringRef fileName, Module &M) {
+
+	std::vector<Value*> values;
+	DenseMap<Value*, int> valueIDs;
+	numberModuleValues(M, values, valueIDs);
+
+	MD5::MD5Result hash;
+	hashModule(M, hash);
+
+	return readFile(fileName, values, hash, getDepGraphFileFlags(false));
+}
+
+bool llvm::Graph::readFromFile(StringRef fileName, Function &F, const MD5::MD5Result &moduleHash) {
+
+	std::vector<Value*> values;
+	DenseMap<Value*, int> valueIDs;
+	numberFunctionValues(F, values, valueIDs);
+
+	MD5::MD5Result hash;
+	hashFunction(F, moduleHash, hash);
+
+	return readFile(fileName, values, hash, getDepGraphFileFlags(true));
+}
+
+bool llvm::Graph::writeFile(StringRef fileName, const DenseMap<Value*, int> &valueIDs, unsigned numValues,
+		const MD5::MD5Result &hash, uint32_t flags) {
+
+	DenseMap<GraphNode*, int> nodeIDs;
+	int numNodes = 0;
+	for (std::set<GraphNode*>::iterator it = nodes.begin(); it != nodes.end(); ++it)
+		nodeIDs[*it] = numNodes++;
+
+	std::vector<DepGraphNodeRecord> nodeRecords;
+	std::vector<DepGraphEdgeRecord> edgeRecords;
+
+	for (std::set<GraphNode*>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+
+		GraphNode* node = *it;
+
+		DepGraphNodeRecord record;
+		record.kind = node->getClass_Id();
+		record.opCode = 0;
+		record.value = -1;
+		record.SCCID = sCCs.size() ? reverseSCCMap[node] : -1;
+
+		Value* v = NULL;
+		if (OpNode* op = dyn_cast<OpNode>(node)) {
+			record.opCode = op->getOpCode();
+			v = op->getValue();
+		} else if (VarNode* var = dyn_cast<VarNode>(node)) {
+			v = var->getValue();
+		} else if (MemNode* mem = dyn_cast<MemNode>(node)) {
+			record.value = mem->getAliasSetId();
+		} else if (BackNode* back = dyn_cast<BackNode>(node)) {
+			if (!nodeIDs.count(back->getNext())) return false;
+			record.value = nodeIDs[back->getNext()];
+		}
+
+		if (v) {
+			//Values from outside M have no stable identifier
+			DenseMap<Value*, int>::const_iterator ID = valueIDs.find(v);
+			if (ID == valueIDs.end()) return false;
+			record.value = ID->second;
+		}
+
+		nodeRecords.push_back(record);
+
+		const std::map<GraphNode*, edgeType> &succs = node->getSuccessors();
+		for (std::map<GraphNode*, edgeType>::const_iterator succ = succs.begin(); succ != succs.end(); ++succ) {
+			if (!nodeIDs.count(succ->first)) return false;
+			DepGraphEdgeRecord edge = {(uint32_t)nodeIDs[node], (uint32_t)nodeIDs[succ->first], (uint32_t)succ->second};
+			edgeRecords.push_back(edge);
+		}
+	}
+
+	std::vector<int32_t> order;
+	if (sCCs.size()) {
+		std::list<int> topologicalOrder = getSCCTopologicalOrder();
+		order.assign(topologicalOrder.begin(), topologicalOrder.end());
+	}
+
+	DepGraphFileHeader header;
+	memcpy(header.magic, DepGraphFileMagic, sizeof(header.magic));
+	header.version = DepGraphFileVersion;
+	header.flags = flags;
+	memcpy(header.moduleHash, hash, sizeof(header.moduleHash));
+	header.numValues = numValues;
+	header.numNodes = nodeRecords.size();
+	header.numEdges = edgeRecords.size();
+	header.numSCCs = order.size();
+
+	//Write to a temporary file of our own first, so that concurrent readers never see half
+	//a graph and concurrent writers do not clobber each other
+	int tmpFD;
+	SmallString<128> tmpName;
+	if (sys::fs::createUniqueFile(fileName + "-%%%%%%%%.tmp", tmpFD, tmpName)) return false;
+	{
+		raw_fd_ostream stream(tmpFD, true);
+
+		stream.write((const char*)&header, sizeof(header));
+		if (nodeRecords.size()) stream.write((const char*)&nodeRecords[0], nodeRecords.size() * sizeof(DepGraphNodeRecord));
+		if (edgeRecords.size()) stream.write((const char*)&edgeRecords[0], edgeRecords.size() * sizeof(DepGraphEdgeRecord));
+		if (order.size()) stream.write((const char*)&order[0], order.size() * sizeof(int32_t));
+
+		stream.close();
+		if (stream.has_error()) {
+			stream.clear_error();
+			sys::fs::remove(tmpName.str());
+			return false;
+		}
+	}
+
+	if (sys::fs::rename(tmpName.str(), fileName)) {
+		sys::fs::remove(tmpName.str());
+		return false;
+	}
+	return true;
+}
+
+bool llvm::Graph::readFile(StringRef fileName, const std::vector<Value*> &values,
+		const MD5::MD5Result &hash, uint32_t flags) {
+
+	OwningPtr<MemoryBuffer> buffer;
+	if (MemoryBuffer::getFile(fileName, buffer, -1, false)) return false;
+
+	const char* data = buffer->getBufferStart();
+	size_t size = buffer->getBufferSize();
+
+	if (size < sizeof(DepGraphFileHeader)) return false;
+	const DepGraphFileHeader* header = (const DepGraphFileHeader*)data;
+
+	if (memcmp(header->magic, DepGraphFileMagic, sizeof(header->magic)) ||
+			header->version != DepGraphFileVersion ||
+			header->flags != flags)
+		return false;
+
+	if (size != sizeof(DepGraphFileHeader) +
+			(uint64_t)header->numNodes * sizeof(DepGraphNodeRecord) +
+			(uint64_t)header->numEdges * sizeof(DepGraphEdgeRecord) +
+			(uint64_t)header->numSCCs * sizeof(int32_t))
+		return false;
+
+	if (memcmp(header->moduleHash, hash, sizeof(header->moduleHash))) return false;
+	if (header->numValues != values.size()) return false;
+
+	const DepGraphNodeRecord* nodeRecords = (const DepGraphNodeRecord*)(header + 1);
+	const DepGraphEdgeRecord* edgeRecords = (const DepGraphEdgeRecord*)(nodeRecords + header->numNodes);
+	const int32_t* order = (const int32_t*)(edgeRecords + header->numEdges);
+
+	//Validate everything before the first node is created
+	std::set<int> SCCIDs(order, order + header->numSCCs);
+	if (SCCIDs.size() != header->numSCCs) return false;
+
+	for (uint32_t i = 0; i < header->numNodes; ++i) {
+
+		const DepGraphNodeRecord &record = nodeRecords[i];
+		int v = record.value;
+
+		switch (record.kind) {
+		case 1:
+			if (v < -1 || v >= (int)values.size()) return false;
+			break;
+		case 2:
+			if (v < 0 || v >= (int)values.size()) return false;
+			break;
+		case 3:
+			if (v < 0 || v >= (int)values.size() || !isa<CallInst>(values[v])) return false;
+			break;
+		case 4:
+			break;
+		case 5:
+			if (v < 0 || v >= (int)header->numNodes || nodeRecords[v].kind == 5) return false;
+			break;
+		default:
+			return false;
+		}
+
+		if (header->numSCCs && !SCCIDs.count(record.SCCID)) return false;
+	}
+
+	for (uint32_t i = 0; i < header->numEdges; ++i) {
+		if (edgeRecords[i].src >= header->numNodes || edgeRecords[i].dst >= header->numNodes ||
+				edgeRecords[i].type > etControl)
+			return false;
+	}
+
+	compactGraphValid = false;
+	invalidateSCCs();
+
+	//Back nodes point to other nodes, so they are created last
+	std::vector<GraphNode*> created(header->numNodes, NULL);
+
+	for (uint32_t i = 0; i < header->numNodes; ++i) {
+
+		const DepGraphNodeRecord &record = nodeRecords[i];
+		Value* v = record.value >= 0 ? values[record.value] : NULL;
+
+		switch (record.kind) {
+		case 1:
+			created[i] = v ? new OpNode(record.opCode, v) : new OpNode(record.opCode);
+			if (v) opNodes[v] = created[i];
+			break;
+		case 2:
+			created[i] = new VarNode(v);
+			varNodes[v] = created[i];
+			break;
+		case 3:
+			created[i] = new CallNode(cast<CallInst>(v));
+			opNodes[v] = created[i];
+			callNodes[v] = created[i];
+			break;
+		case 4:
+			created[i] = new MemNode(record.value, AS);
+			memNodes[record.value] = created[i];
+			break;
+		default:
+			continue;
+		}
+
+		nodes.insert(created[i]);
+	}
+
+	for (uint32_t i = 0; i < header->numNodes; ++i) {
+
+		if (nodeRecords[i].kind != 5) continue;
+
+		GraphNode* next = created[nodeRecords[i].value];
+		BackNode* back = new BackNode(next);
+		backNodes[next] = back;
+		created[i] = back;
+		nodes.insert(back);
+	}
+
+	for (uint32_t i = 0; i < header->numEdges; ++i)
+		created[edgeRecords[i].src]->connect(created[edgeRecords[i].dst], (edgeType)edgeRecords[i].type);
+
+	if (header->numSCCs) {
+
+		for (uint32_t i = 0; i < header->numNodes; ++i) {
+			sCCs[nodeRecords[i].SCCID].insert(created[i]);
+			reverseSCCMap[created[i]] = nodeRecords[i].SCCID;
+		}
+
+		sccOrder.assign(order, order + header->numSCCs);
+		for (unsigned slot = 0; slot < sccOrder.size(); ++slot) {
+			sccSlot[sccOrder[slot]] = slot;
+			nextSCCID = std::max(nextSCCID, sccOrder[slot] + 1);
+		}
+	}
+
+	return true;
+}
+
 void llvm::Graph::Guider::setNodeAttrs(GraphNode* n, std::string attrs) {
         nodeAttrs[n] = attrs;
 }
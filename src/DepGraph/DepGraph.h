@@ -21,15 +21,20 @@
 #include "llvm/Support/CallSite.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/GraphWriter.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/raw_ostream.h"
 #include "LoopInfoEx.h"
 #include "AliasSets.h"
 #include "GenericGraph.h"
+#include <algorithm>
+#include <atomic>
 #include <list>
 #include <map>
 #include <set>
 #include <stack>
 #include <sstream>
+#include <thread>
+#include <vector>
 #include <stdio.h>
 
 using namespace std;
@@ -66,7 +71,7 @@ private:
         std::map<GraphNode*, edgeType> successors;
         std::map<GraphNode*, edgeType> predecessors;
 
-        static int currentID;
+        static std::atomic<int> currentID; //Graphs may be built concurrently
         int ID;
 
 protected:
@@ -81,10 +86,10 @@ public:
                 return true;
         }
         ;
-        std::map<GraphNode*, edgeType> getSuccessors();
+        const std::map<GraphNode*, edgeType>& getSuccessors();
         bool hasSuccessor(GraphNode* succ);
 
-        std::map<GraphNode*, edgeType> getPredecessors();
+        const std::map<GraphNode*, edgeType>& getPredecessors();
         bool hasPredecessor(GraphNode* pred);
 
         void connect(GraphNode* dst, edgeType type = etData);
@@ -296,6 +301,92 @@ public:
 
 
 
+/*
+ * Class CompactGraph
+ *
+ * Frozen, read-only copy of the edges of a Graph, laid out for the graph algorithms:
+ *              - Nodes get dense IDs; the nodes of the graph come first, in the order of
+ *                the graph's node set, followed by nodes only reached through edges
+ *              - Successors and predecessors are stored in CSR arrays
+ *              - Edge types are stored as one bit per edge
+ *
+ * Graph::getCompactGraph builds it on demand; any change to the graph drops it.
+ * A CompactGraph built with restrictToNodes drops the edges that leave the node set.
+ */
+class CompactGraph {
+private:
+        std::vector<GraphNode*> nodeList;
+        llvm::DenseMap<GraphNode*, unsigned> nodeIDs;
+        unsigned numGraphNodes;
+
+        std::vector<unsigned> succOffsets, succTargets;
+        std::vector<unsigned> predOffsets, predTargets;
+        std::vector<bool> succControl, predControl;
+
+        unsigned getOrAddID(GraphNode* node);
+
+public:
+        typedef std::vector<unsigned>::const_iterator edge_iterator;
+
+        CompactGraph() : numGraphNodes(0) {}
+        explicit CompactGraph(const std::set<GraphNode*> &nodes, bool restrictToNodes = false);
+
+        unsigned getNumNodes() const { return nodeList.size(); }
+        unsigned getNumGraphNodes() const { return numGraphNodes; }
+        unsigned getNumEdges() const { return succTargets.size(); }
+
+        GraphNode* getNode(unsigned ID) const { return nodeList[ID]; }
+        int getNodeID(GraphNode* node) const; //Return -1 if the node is unknown
+
+        edge_iterator succ_begin(unsigned ID) const { return succTargets.begin() + succOffsets[ID]; }
+        edge_iterator succ_end(unsigned ID) const { return succTargets.begin() + succOffsets[ID + 1]; }
+        edge_iterator pred_begin(unsigned ID) const { return predTargets.begin() + predOffsets[ID]; }
+        edge_iterator pred_end(unsigned ID) const { return predTargets.begin() + predOffsets[ID + 1]; }
+
+        unsigned getNumSuccessors(unsigned ID) const { return succOffsets[ID + 1] - succOffsets[ID]; }
+        unsigned getNumPredecessors(unsigned ID) const { return predOffsets[ID + 1] - predOffsets[ID]; }
+
+        edgeType getSuccEdgeType(edge_iterator succ) const {
+                return succControl[succ - succTargets.begin()] ? etControl : etData;
+        }
+        edgeType getPredEdgeType(edge_iterator pred) const {
+                return predControl[pred - predTargets.begin()] ? etControl : etData;
+        }
+};
+
+/*
+ * Class AcyclicPathEnumerator
+ *
+ * Lazily enumerates the acyclic paths from a source to a destination node, one per call
+ * to next. If source and destination are the same node, the paths are the simple cycles
+ * through it. Paths only go through the given nodes, and the search only descends into
+ * nodes from which the destination can still be reached, so every step leads to a path.
+ */
+class AcyclicPathEnumerator {
+private:
+        CompactGraph CG;
+        int src, dst;
+
+        //Nodes on the current path, and the index of the next successor to try for each.
+        //Indices rather than edge iterators, so that the enumerator can be copied along
+        //with the CompactGraph it owns
+        std::vector<unsigned> path;
+        std::vector<unsigned> nextSucc;
+        std::vector<char> onPath;
+        bool started;
+
+        std::vector<unsigned> reached;
+        unsigned stamp;
+
+        bool canReachDst(unsigned ID);
+
+public:
+        AcyclicPathEnumerator(const std::set<GraphNode*> &nodes, GraphNode* src, GraphNode* dst);
+
+        //Return false if there are no more paths
+        bool next(std::vector<GraphNode*> &result);
+};
+
 /*
  * Class Graph
  *
@@ -325,7 +416,13 @@ private:
 		//Graph analysis - Strongly connected components
 		std::map<int, std::set<GraphNode*> > sCCs;
 		std::map<GraphNode*, int> reverseSCCMap;
-		std::list<int> topologicalOrderedSCCs;
+		std::vector<int> sccOrder;				//SCC IDs in topological order; -1 marks a free slot
+		std::map<int, unsigned> sccSlot;		//Position of each SCC in sccOrder
+		int nextSCCID;
+
+		//Frozen CSR copy of the edges, valid until the graph changes
+		CompactGraph compactGraph;
+		bool compactGraphValid;
 
 
 
@@ -334,6 +431,21 @@ private:
         bool isValidInst(Value *v); //Return true if the instruction is valid for dependence graph construction
         bool isMemoryPointer(Value *v); //Return true if the value is a memory pointer
 
+        //Incremental maintenance of the SCCs, applied only while they are computed
+        void invalidateSCCs();
+        void addNodeToSCCs(GraphNode* node);
+        void addEdgeToSCCs(GraphNode* src, GraphNode* dst);
+        void removeEdgeFromSCCs(GraphNode* src, GraphNode* dst);
+        void removeNodeFromSCCs(GraphNode* node);
+        void splitSCC(int SCCID);
+        void collectSCCs(int SCCID, unsigned lower, unsigned upper, bool forward, std::set<int> &result);
+
+        //Serialization of the graph under a given value numbering and hash
+        bool writeFile(StringRef fileName, const DenseMap<Value*, int> &valueIDs, unsigned numValues,
+                const MD5::MD5Result &hash, uint32_t flags);
+        bool readFile(StringRef fileName, const std::vector<Value*> &values,
+                const MD5::MD5Result &hash, uint32_t flags);
+
 public:
         typedef std::set<GraphNode*>::iterator iterator;
 
@@ -341,13 +453,17 @@ public:
         std::set<GraphNode*>::iterator end();
 
         Graph(AliasSets *AS) :
-        	parentGraph(NULL), AS(AS){
+        	parentGraph(NULL), nextSCCID(0), compactGraphValid(false), AS(AS){
             NrEdges = 0;
         }
         ; //Constructor
         ~Graph(); //Destructor - Free adjacent matrix's memory
         GraphNode* addInst(Value *v); //Add an instruction into Dependence Graph
 
+        //Move the nodes of G into this graph; nodes of the same value or alias set are unified. G is left empty
+        //and no longer refers to the moved nodes, so it may be deleted
+        void mergeGraph(Graph &G);
+
         void removeNode(GraphNode* target);
 
         void addEdge(GraphNode* src, GraphNode* dst, edgeType type = etData);
@@ -358,6 +474,22 @@ public:
 
         std::set<GraphNode*> findNodes(std::set<Value*> values);
 
+        //Binary serialization. Values are keyed by their position in a walk over M, so
+        //readFromFile fails (leaving the graph untouched) if the file was written for
+        //another module, another version of M or with other options
+        bool writeToFile(StringRef fileName, Module &M);
+        bool readFromFile(StringRef fileName, Module &M);
+
+        //Same for the graph of F alone, keyed on the text of F and on moduleHash, the
+        //hashModule of its module, which callers compute once per module
+        bool writeToFile(StringRef fileName, Function &F, const MD5::MD5Result &moduleHash);
+        bool readFromFile(StringRef fileName, Function &F, const MD5::MD5Result &moduleHash);
+
+        static void hashModule(Module &M, MD5::MD5Result &result);
+
+        //Return the CSR view of the graph, building it if the graph has changed
+        const CompactGraph& getCompactGraph();
+
         OpNode* findOpNode(Value *op); //Return the pointer to the node or NULL if it is not in the graph
 
         //print graph in dot format
@@ -438,17 +570,11 @@ public:
 
         llvm::DenseMap<GraphNode*, BackNode*> getBackNodes() {return backNodes;};
 
-        void strongconnect(GraphNode* node,
-        		           std::map<GraphNode*, int> &index,
-        		           std::map<GraphNode*, int> &lowlink,
-        		           int &currentIndex,
-        		           std::stack<GraphNode*> &S,
-        		           std::set<GraphNode*> &S2,
-        		           std::map<int, std::set<GraphNode*> > &SCCs);
-
-
         /*
          * Methods to handle SCCs in the Dependence Graph
+         *
+         * SCCs are computed on demand; once computed, addEdge, removeEdge, removeNode and
+         * the back node methods keep them and their topological order up to date.
          */
         void recomputeSCCs();
         std::map<int, std::set<GraphNode*> > getSCCs();
@@ -459,22 +585,26 @@ public:
 
         void dumpSCCs();
 
-        bool acyclicPathExists(GraphNode* src,
-        		GraphNode* dst,
-                std::set<GraphNode*> alreadyVisitedNodes,
-                int SCCID);
-
         bool hasNestedLoop(int SCCID);
         bool hasNestedLoop(GraphNode* first);
 
-        void getAcyclicPaths_rec(GraphNode* dst,
-        		                 std::set<GraphNode*> &visitedNodes,
-        		                 std::stack<GraphNode*> &path,
-        		                 std::set<std::stack<GraphNode*> > &result,
-        		                 int SCCID);
+        /*
+         * Path queries
+         *
+         * Acyclic paths are enumerated lazily; the methods that return them as stacks (with dst
+         * on top) stop after limit paths. Paths inside an SCC only use nodes of the SCC of src.
+         */
+        AcyclicPathEnumerator enumerateAcyclicPaths(GraphNode* src, GraphNode* dst, bool insideSCC);
+        unsigned countAcyclicPaths(GraphNode* src, GraphNode* dst, bool insideSCC, unsigned limit);
+
+        std::set<std::stack<GraphNode*> > getAcyclicPaths(GraphNode* src, GraphNode* dst, unsigned limit = 1000);
+        std::set<std::stack<GraphNode*> > getAcyclicPathsInsideSCC(GraphNode* src, GraphNode* dst, unsigned limit = 1000);
 
-        std::set<std::stack<GraphNode*> > getAcyclicPaths(GraphNode* src, GraphNode* dst);
-        std::set<std::stack<GraphNode*> > getAcyclicPathsInsideSCC(GraphNode* src, GraphNode* dst);
+        //Number of paths from the SCC of src to the SCC of dst in the DAG of SCCs (saturates at UINT64_MAX)
+        uint64_t countCondensationPaths(GraphNode* src, GraphNode* dst);
+
+        //Up to k shortest acyclic paths from src to dst, shortest first (Yen's algorithm)
+        std::vector<std::vector<GraphNode*> > getShortestPaths(GraphNode* src, GraphNode* dst, unsigned k, bool insideSCC);
 
 };
 
@@ -491,9 +621,13 @@ public:
                 FunctionPass(ID), depGraph(NULL) {
         }
         void getAnalysisUsage(AnalysisUsage &AU) const;
+        bool doInitialization(Module &M);
         bool runOnFunction(Function&);
 
         Graph* depGraph;
+
+private:
+        MD5::MD5Result moduleHash;	//Key of the cached graphs, hashed once per module
 };
 
 /*
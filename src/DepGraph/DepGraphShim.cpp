@@ -0,0 +1,20 @@
+/*
+ * DepGraphShim.cpp
+ *
+ * C entry points for modules that use DepGraph's analyses without linking
+ * against DepGraph.so. They look the passes up by name and only call these
+ * functions once the passes have run, so the references are bound lazily.
+ */
+
+#include "AliasSets.h"
+#include "TripCountAnalysis.h"
+
+using namespace llvm;
+
+extern "C" int DepGraph_GetValueSetKey(Pass *AS, Value *V) {
+	return static_cast<AliasSets*>(AS)->getValueSetKey(V);
+}
+
+extern "C" Instruction *DepGraph_GetTripCount(Pass *TCA, BasicBlock *Header) {
+	return static_cast<TripCountAnalysis*>(TCA)->getTripCount(Header);
+}
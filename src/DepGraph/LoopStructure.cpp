@@ -247,9 +247,10 @@ bool LoopStructure::runOnFunction(Function& F) {
 
 								GraphNode* firstNodeVisitedInSCC = firstNodeVisitedPerSCC[SCCID];
 
-								std::set<std::stack<GraphNode*> > paths = graph->getAcyclicPathsInsideSCC(firstNodeVisitedInSCC, firstNodeVisitedInSCC);
+								//Two paths are enough to tell single-path SCCs apart
+								unsigned numPaths = graph->countAcyclicPaths(firstNodeVisitedInSCC, firstNodeVisitedInSCC, true, 2);
 
-								if (paths.size() == 1){
+								if (numPaths == 1){
 									NumSinglePathSCCs++;
 								} else {
 									NumMultiPathSCCs++;
@@ -1299,6 +1299,7 @@ bool AddressSanitizer::runOnFunction(Function &F) {
   SmallVector<Instruction*, 16> ToInstrument;
   SmallVector<Instruction*, 16> ToVerify; // __fasan_verify
   SmallVector<Instruction*, 16> ToTouch; // __fasan_touch
+  SmallVector<Instruction*, 16> ToShadow; // __fasan_shadow
   SmallVector<Instruction*, 8> NoReturnCalls;
   int NumAllocas = 0;
   bool IsWrite;
@@ -1315,6 +1316,8 @@ bool AddressSanitizer::runOnFunction(Function &F) {
                 ToTouch.push_back(call);
             } else if (call->getCalledFunction()->getName() == "__fasan_verify") {
                 ToVerify.push_back(call);
+            } else if (call->getCalledFunction()->getName() == "__fasan_shadow") {
+                ToShadow.push_back(call);
             }
         }
     }
@@ -1334,6 +1337,8 @@ bool AddressSanitizer::runOnFunction(Function &F) {
       }
       if (safeUsers.find(BI) != safeUsers.end()) continue;
 #endif
+      // shadow memory reads of the FASan runtime
+      if (BI->getMetadata("fasan.trusted")) continue;
       if (Value *Addr = isInterestingMemoryAccess(BI, &IsWrite)) {
         if (ClOpt && ClOptSameTemp) {
           if (!TempsToInstrument.insert(Addr))
@@ -1381,6 +1386,16 @@ bool AddressSanitizer::runOnFunction(Function &F) {
       verifyCall->eraseFromParent();
   }
   
+  // Supplement __fasan_shadow
+  for (size_t i = 0, n = ToShadow.size(); i != n; i++) {
+      CallInst * shadowCall = cast<CallInst>(ToShadow[i]);
+      IRBuilder<> IRB(shadowCall);
+      Value * addrLong = IRB.CreatePointerCast(shadowCall->getOperand(0), IntptrTy);
+      Value * shadowPtr = IRB.CreateIntToPtr(memToShadow(addrLong, IRB), shadowCall->getType());
+      shadowCall->replaceAllUsesWith(shadowPtr);
+      shadowCall->eraseFromParent();
+  }
+
   // Supplement __fasan_touch
   for (size_t i = 0, n = ToTouch.size(); i != n; i++) {
       Instruction * Inst = ToTouch[i];
@@ -454,6 +454,14 @@ bool Expr::has(Expr Ex) const {
   return Expr_.has(Ex.getExpr());
 }
 
+int Expr::degree(Expr Ex) const {
+  return Expr_.expand().degree(Ex.getExpr());
+}
+
+Expr Expr::coeff(Expr Ex, int N) const {
+  return Expr_.expand().coeff(Ex.getExpr(), N);
+}
+
 Expr Expr::InvalidExpr() {
   static Expr Invalid(string("__INVALID__"));
   return Invalid;
@@ -146,6 +146,10 @@ public:
   bool match(Expr Ex)               const;
   bool has(Expr Ex)                 const;
 
+  // Degree in Ex & coefficient of Ex^N, both taken on the expanded expression.
+  int  degree(Expr Ex)              const;
+  Expr coeff(Expr Ex, int N = 1)    const;
+
   static Expr InvalidExpr();
   static Expr WildExpr();
 
@@ -1,8 +1,11 @@
 #include "RangedAddressSanitizer.h"
 
 #include "llvm/Transforms/Instrumentation.h"
+#include "llvm/ADT/DepthFirstIterator.h"
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
@@ -12,12 +15,14 @@
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/CFG.h"
+#include "llvm/Support/CallSite.h"
 #if 0
 #include "llvm/Linker.h"
 #endif
 
 #include "FAsanConfig.hpp"
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
@@ -38,6 +43,49 @@ static cl::opt<bool>
                    "transformation"),
           cl::Hidden, cl::init(false));
 
+static cl::opt<bool>
+  ClSplit("fasan-split",
+          cl::desc("Run the safe iterations of a nest unchecked when its range "
+                   "check fails"),
+          cl::Hidden, cl::init(true));
+
+static cl::opt<bool>
+  ClElimRedundant("fasan-elim-redundant",
+                  cl::desc("Reuse the result of a dominating range check that "
+                           "covers the range of a later one"),
+                  cl::Hidden, cl::init(true));
+
+static cl::opt<bool>
+  ClStaticBounds("fasan-static-bounds",
+                 cl::desc("Do not check accesses that provably stay within a "
+                          "stack array or global"),
+                 cl::Hidden, cl::init(true));
+
+static cl::opt<bool>
+  ClCostModel("fasan-cost-model",
+              cl::desc("Only clone nests whose estimated savings exceed the "
+                       "cost of their range checks (static estimate, "
+                       "uncalibrated)"),
+              cl::Hidden, cl::init(false));
+
+static cl::opt<unsigned>
+  ClCloneGrowth("fasan-clone-growth",
+                cl::desc("Code growth allowed for cloned nests, in percent of "
+                         "the function size"),
+                cl::Hidden, cl::init(100));
+
+static cl::opt<unsigned>
+  ClAssumedTripCount("fasan-assumed-trip-count",
+                     cl::desc("Value assumed for unknown trip counts and "
+                              "symbolic bounds by the cost model"),
+                     cl::Hidden, cl::init(100));
+
+static cl::opt<bool>
+  ClStats("fasan-stats",
+          cl::desc("Count the entries into the checked and unchecked version "
+                   "of each nest; the runtime reports them at exit"),
+          cl::Hidden, cl::init(false));
+
 static cl::opt<std::string>
   ClFunc("spm-pthread-function",
          cl::desc("Only analyze/transform the given function"),
@@ -60,6 +108,22 @@ FunctionPass* llvm::createRangedAddressSanitizerPass()
 
 /* ************************************************************************** */
 /* ************************************************************************** */
+
+// Copies the body of runtime function Src into Dst, which lives in the target module
+static void CloneRuntimeFunction(Function * Dst, const Function * Src, ValueToValueMapTy & reMap)
+{
+  // Loop over the arguments, copying the names of the mapped arguments over...
+    Function::arg_iterator DestI = Dst->arg_begin();
+    for (Function::const_arg_iterator I = Src->arg_begin(), E = Src->arg_end();
+         I != E; ++I)
+       if (reMap.count(I) == 0) {   // Is this argument preserved?
+        DestI->setName(I->getName()); // Copy the name over...
+        reMap[I] = DestI++;        // Add mapping to VMap
+    }
+    SmallVector<ReturnInst*, 8> Returns;  // Ignore returns cloned.
+    CloneFunctionInto(Dst, Src, reMap, false, Returns, "", nullptr);
+}
+
 bool RangedAddressSanitizer::doInitialization(Module &M)
 {
 // Link FastAddressSanitizer functions into the target module
@@ -87,16 +151,47 @@ bool RangedAddressSanitizer::doInitialization(Module &M)
     }
 
 #else
-    PointerType * voidPtrTy = PointerType::getInt8PtrTy(context, 0);
-    IntegerType * boolTy = IntegerType::get(context, 1);
-    Type * voidTy = Type::getVoidTy(context);
-    FunctionType * touchFunType = FunctionType::get(voidTy, ArrayRef<Type*>(voidPtrTy), false);
-    FunctionType * verifyFunType = FunctionType::get(boolTy, ArrayRef<Type*>(voidPtrTy), false);
-
+    // Functions the runtime only declares are re-declared in the target module:
+    // fake functions supplemented by AddressSanitizer (__fasan_touch,
+    // __fasan_verify, __fasan_shadow), intrinsics and the ASan interface.
     ValueToValueMapTy reMap;
-    reMap[fasanModule->getFunction("__fasan_touch")] = M.getOrInsertFunction("__fasan_touch", touchFunType);
-    reMap[fasanModule->getFunction("__fasan_verify")] = M.getOrInsertFunction("__fasan_verify", verifyFunType);
-    
+    for (Function & runtimeFunc : *fasanModule) {
+        if (runtimeFunc.isDeclaration())
+            reMap[&runtimeFunc] = M.getOrInsertFunction(runtimeFunc.getName(), runtimeFunc.getFunctionType());
+    }
+
+    // Globals of the runtime (the range cache and the poisoning epoch) are copied as well.
+    // External ones become weak, so that all instrumented modules share a single copy.
+    for (GlobalVariable & runtimeGlobal : fasanModule->getGlobalList()) {
+        GlobalValue::LinkageTypes linkage = runtimeGlobal.getLinkage();
+        if (!runtimeGlobal.hasInitializer())
+            linkage = GlobalValue::ExternalLinkage;
+        else if (!runtimeGlobal.hasLocalLinkage())
+            linkage = GlobalValue::WeakAnyLinkage;
+        GlobalVariable * targetGlobal = new GlobalVariable(M, runtimeGlobal.getType()->getElementType(),
+            runtimeGlobal.isConstant(), linkage,
+            runtimeGlobal.hasInitializer() ? runtimeGlobal.getInitializer() : nullptr,
+            runtimeGlobal.getName(), nullptr, runtimeGlobal.getThreadLocalMode());
+        reMap[&runtimeGlobal] = targetGlobal;
+    }
+
+    // Allocator hooks (__asan_free_hook) are defined by the runtime and called by ASan.
+    // With -fasan-stats, the nest counters and their report are copied along.
+    std::vector<Function*> hookFuncs;
+    for (Function & runtimeFunc : *fasanModule) {
+        if (!runtimeFunc.isDeclaration() && !runtimeFunc.hasLocalLinkage() &&
+            (runtimeFunc.getName().startswith("__asan_") ||
+             (ClStats && runtimeFunc.getName().startswith("__fasan_stats_")))) {
+            Function * targetFunc = Function::Create(runtimeFunc.getFunctionType(), GlobalValue::WeakAnyLinkage,
+                                                     runtimeFunc.getName(), &M);
+            reMap[&runtimeFunc] = targetFunc;
+            hookFuncs.push_back(&runtimeFunc);
+        }
+    }
+    for (Function * hookFunc : hookFuncs) {
+        CloneRuntimeFunction(cast<Function>(reMap[hookFunc]), hookFunc, reMap);
+    }
+
     // migrate check function
     {
         std::string errMsg;
@@ -106,22 +201,30 @@ bool RangedAddressSanitizer::doInitialization(Module &M)
         }
 
 #if 1
-        FunctionType * checkFuncType = checkFunc->getFunctionType();
-        Function * targetFunc = dyn_cast<Function>(M.getOrInsertFunction("__fasan_check", checkFuncType));
-        assert(targetFunc && "function cast to const by getOrInsertFunc..?");
+        // The range check & the iteration space splitting queries
+        MDNode * trustedNode = MDNode::get(context, ArrayRef<Value*>());
+        const char * runtimeFuncNames[] = { "__fasan_check", "__fasan_safe_prefix", "__fasan_safe_suffix" };
+        for (const char * runtimeFuncName : runtimeFuncNames) {
+            Function * runtimeFunc = fasanModule->getFunction(runtimeFuncName);
+            if (!runtimeFunc) {
+                continue;
+            }
 
-      // Loop over the arguments, copying the names of the mapped arguments over...
-        Function::arg_iterator DestI = targetFunc->arg_begin();
-        for (Function::const_arg_iterator I = checkFunc->arg_begin(), E = checkFunc->arg_end();
-             I != E; ++I)
-           if (reMap.count(I) == 0) {   // Is this argument preserved?
-            DestI->setName(I->getName()); // Copy the name over...
-            reMap[I] = DestI++;        // Add mapping to VMap
-        }
-        SmallVector<ReturnInst*, 8> Returns;  // Ignore returns cloned.
-        CloneFunctionInto(targetFunc, checkFunc, reMap, false, Returns, "", nullptr);
+            Function * targetFunc = dyn_cast<Function>(M.getOrInsertFunction(runtimeFuncName, runtimeFunc->getFunctionType()));
+            assert(targetFunc && "function cast to const by getOrInsertFunc..?");
+            CloneRuntimeFunction(targetFunc, runtimeFunc, reMap);
+
+            targetFunc->addAttribute(0,Attribute::SanitizeAddress);
 
-        targetFunc->addAttribute(0,Attribute::SanitizeAddress);
+            // The runtime reads shadow memory directly; those reads must not be
+            // instrumented themselves. The tag survives inlining into the loops.
+            for (auto & BB : *targetFunc) {
+                for (auto & Inst : BB) {
+                    if (isa<LoadInst>(Inst) || isa<StoreInst>(Inst))
+                        Inst.setMetadata("fasan.trusted", trustedNode);
+                }
+            }
+        }
 
 #else
         Function * clonedCheckFunc = CloneFunction(checkFunc, reMap, false, 0);
@@ -146,13 +249,11 @@ bool RangedAddressSanitizer::doInitialization(Module &M)
 
 bool RangedAddressSanitizer::doFinalization(Module &M)
 {
-    Function * checkFunc = M.getFunction("__fasan_check");
-    if (checkFunc) {
-    	for (Value::use_iterator itUse = checkFunc->use_begin(); itUse != checkFunc->use_end(); ++itUse) {
-    		CallInst * call = dyn_cast<CallInst>(*itUse);
-    	}
-
-        checkFunc->eraseFromParent();
+    const char * runtimeFuncNames[] = { "__fasan_check", "__fasan_safe_prefix", "__fasan_safe_suffix" };
+    for (const char * runtimeFuncName : runtimeFuncNames) {
+        if (Function * runtimeFunc = M.getFunction(runtimeFuncName)) {
+            runtimeFunc->eraseFromParent();
+        }
     }
     return true;
 
@@ -167,10 +268,314 @@ void RangedAddressSanitizer::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<RelativeExecutions>();
 #endif
   AU.addRequired<RelativeMinMax>();
+  AU.addRequired<LoopInfoExpr>();
   AU.addRequired<SymPyInterface>();
   // AU.setPreservesAll();
 }
 
+// Cost model for cloning, in rough cycles: an ASan check on each access (shadow load,
+// compare & branch) against a call to __fasan_check, which scans one vector of shadow
+// bytes, i.e. 128 bytes of the array, per cycle.
+static const double AccessCheckCost   = 4.0;
+static const double RangeCheckCost    = 40.0;
+static const double BytesPerScanCycle = 128.0;
+
+// Numeric value of Ex, with ClAssumedTripCount in place of any symbol
+static double EstimateValue(Expr Ex, double Default)
+{
+    if (!Ex.isValid()) {
+        return Default;
+    }
+    for (auto & symbol : Ex.getSymbols()) {
+        Ex = Ex.subs(symbol, Expr((long)ClAssumedTripCount));
+    }
+
+    if (Ex.isInteger())
+        return std::max(0.0, (double)Ex.getInteger());
+    if (Ex.isRational())
+        return std::max(0.0, (double)Ex.getRationalNumer()/Ex.getRationalDenom());
+    if (Ex.isFloat())
+        return std::max(0.0, Ex.getFloat());
+    return Default;
+}
+
+double RangedAddressSanitizer::estimateExecutions(Loop * finalLoop, BasicBlock * block)
+{
+    Loop * loop = LI_->getLoopFor(block);
+#ifdef ENABLE_REUSE
+    Loop * reached;
+    Expr executionsEx = RE_->getExecutionsRelativeTo(loop, nullptr, reached);
+    if (executionsEx.isValid() && reached == finalLoop) {
+        return EstimateValue(executionsEx, ClAssumedTripCount);
+    }
+#endif
+
+    double executions = 1.0;
+    for (; loop && loop != finalLoop->getParentLoop(); loop = loop->getParentLoop()) {
+        PHINode * indVar;
+        Expr indStart, indEnd, indStep, loEx, hiEx;
+        Expr tripEx = Expr::InvalidExpr();
+        if (LIE_->getLoopInfo(loop, indVar, indStart, indEnd, indStep) &&
+            RMM_->getMinMax(Expr(indVar), loEx, hiEx)) {
+            tripEx = (hiEx - loEx) / indStep + 1;
+        }
+        executions *= EstimateValue(tripEx, ClAssumedTripCount);
+    }
+    return executions;
+}
+
+double RangedAddressSanitizer::estimateCloningGain(Loop * finalLoop, const std::vector<CallInfo> & calls,
+                                                   const std::set<Instruction*> & proven)
+{
+    double saved = 0.0;
+    for (Instruction * inst : proven) {
+        saved += AccessCheckCost * estimateExecutions(finalLoop, inst->getParent());
+    }
+
+    double cost = 0.0;
+    for (auto & CI : calls) {
+        cost += RangeCheckCost + EstimateValue(CI.MaxEx - CI.MinEx, 0.0) / BytesPerScanCycle;
+    }
+
+    SPM_DEBUG( dbgs() << "FASan: nest at " << finalLoop->getHeader()->getName() << " saves " << saved
+                      << ", checks cost " << cost << "\n" );
+    return saved - cost;
+}
+
+void RangedAddressSanitizer::selectProfitableNests(Function &F, std::map<BasicBlock*, std::vector<CallInfo> > & nestCalls)
+{
+    long functionSize = 0;
+    for (auto & block : F) {
+        functionSize += block.size();
+    }
+    long budget = functionSize * ClCloneGrowth / 100;
+
+  // The most profitable nests get their clones first
+    std::vector<std::pair<double, BasicBlock*> > gains;
+    for (auto & nest : nestCalls) {
+        double gain = estimateCloningGain(nest.second.front().FinalLoop, nest.second, ProvenAccesses_[nest.first]);
+        if (gain > 0.0) {
+            gains.push_back(std::make_pair(gain, nest.first));
+        }
+    }
+    std::sort(gains.rbegin(), gains.rend());
+
+    std::map<BasicBlock*, std::vector<CallInfo> > selected;
+    for (auto & gain : gains) {
+        Loop * finalLoop = nestCalls[gain.second].front().FinalLoop;
+        long nestSize = 0;
+        for (auto itBlock = finalLoop->block_begin(); itBlock != finalLoop->block_end(); ++itBlock) {
+            nestSize += (*itBlock)->size();
+        }
+
+        if (nestSize > budget) {
+            SPM_DEBUG( dbgs() << "FASan: no code size budget left for nest at "
+                              << finalLoop->getHeader()->getName() << "\n" );
+            continue;
+        }
+        budget -= nestSize;
+        selected[gain.second] = nestCalls[gain.second];
+    }
+
+    nestCalls.swap(selected);
+}
+
+// Returns true if A >= B can be shown from the structure of the expressions
+static bool IsNotLess(Expr A, Expr B)
+{
+    if (!A.isValid() || !B.isValid()) {
+        return false;
+    }
+
+    Expr diff = A - B;
+    if (diff.isConstant() && !diff.isNegative()) {
+        return true;
+    }
+
+    // A >= min(B_i) if A >= some B_i, and max(A_i) >= B if some A_i >= B
+    if (B.isMin()) {
+        for (unsigned i = 0; i < B.nops(); ++i) {
+            if (IsNotLess(A, B.at(i)))
+                return true;
+        }
+    }
+    if (A.isMax()) {
+        for (unsigned i = 0; i < A.nops(); ++i) {
+            if (IsNotLess(A.at(i), B))
+                return true;
+        }
+    }
+
+    // A >= max(B_i) if A >= every B_i, and min(A_i) >= B if every A_i >= B
+    if (B.isMax()) {
+        for (unsigned i = 0; i < B.nops(); ++i) {
+            if (!IsNotLess(A, B.at(i)))
+                return false;
+        }
+        return true;
+    }
+    if (A.isMin()) {
+        for (unsigned i = 0; i < A.nops(); ++i) {
+            if (!IsNotLess(A.at(i), B))
+                return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// Returns true if memory may be released on a path from the end of From to the end of To.
+// From must dominate To. Any call that may write memory is assumed to free or realloc;
+// the end of a lifetime may poison a stack array.
+static bool MayFreeBetween(BasicBlock * From, BasicBlock * To)
+{
+    std::set<BasicBlock*> visited;
+    std::vector<BasicBlock*> worklist;
+    if (From != To) {
+        worklist.push_back(To);
+    }
+
+    while (!worklist.empty()) {
+        BasicBlock * block = worklist.back();
+        worklist.pop_back();
+        if (!visited.insert(block).second) {
+            continue;
+        }
+
+        for (auto & inst : *block) {
+            CallSite callSite(&inst);
+            if (!callSite) {
+                continue;
+            }
+
+            Function * callee = callSite.getCalledFunction();
+            if (callee && callee->getName().startswith("__fasan_")) {
+                continue;
+            }
+            if (IntrinsicInst * intrinsic = dyn_cast<IntrinsicInst>(&inst)) {
+                if (intrinsic->getIntrinsicID() != Intrinsic::lifetime_end) {
+                    continue;
+                }
+            } else if (callSite.onlyReadsMemory()) {
+                continue;
+            }
+
+            SPM_DEBUG( dbgs() << "FASan: memory may be released by " << inst << "\n" );
+            return true;
+        }
+
+        for (pred_iterator itPred = pred_begin(block); itPred != pred_end(block); ++itPred) {
+            if (*itPred != From) {
+                worklist.push_back(*itPred);
+            }
+        }
+    }
+
+    return false;
+}
+
+void RangedAddressSanitizer::emitNestStats(IRBuilder<> & IRB, Function &F, BasicBlock * Preheader, Loop * finalLoop,
+                                           Value * allSafe)
+{
+    IntegerType * IntTy = IRB.getInt64Ty();
+    PointerType * VoidPtrTy = IRB.getInt8PtrTy();
+
+  // Mirrors FASanNestStats in the runtime
+    StructType * statsTy = StructType::get(VoidPtrTy, IntTy, IntTy, IntTy, IntTy, VoidPtrTy, IntTy, NULL);
+    std::string name = (F.getName() + ":" + finalLoop->getHeader()->getName()).str();
+    Constant * zero = IRB.getInt64(0);
+    Constant * fields[] = {
+        cast<Constant>(IRB.CreateGlobalStringPtr(name, "fasan.nest.name")),
+        IRB.getInt64(ProvenAccesses_[Preheader].size()),
+        zero, zero, zero,
+        ConstantPointerNull::get(VoidPtrTy),
+        zero
+    };
+    GlobalVariable * stats = new GlobalVariable(*Module_, statsTy, false, GlobalValue::PrivateLinkage,
+                                                ConstantStruct::get(statsTy, fields), "fasan.nest.stats");
+
+  // The runtime adds the bytes scanned by the checks of the nest, which run right before
+    Constant * countFn = Module_->getOrInsertFunction("__fasan_stats_count", IRB.getVoidTy(),
+                                                      VoidPtrTy, IRB.getInt1Ty(), NULL);
+    IRB.CreateCall2(countFn, IRB.CreateBitCast(stats, VoidPtrTy), allSafe);
+}
+
+bool RangedAddressSanitizer::isWithinObject(Value * Array, Expr Begin, Expr End)
+{
+    Value * object = Array->stripPointerCasts();
+    uint64_t objectSize;
+    if (AllocaInst * allocaInst = dyn_cast<AllocaInst>(object)) {
+        ConstantInt * numElems = dyn_cast<ConstantInt>(allocaInst->getArraySize());
+        if (!numElems) {
+            return false;
+        }
+        objectSize = DL_->getTypeAllocSize(allocaInst->getAllocatedType()) * numElems->getZExtValue();
+    } else if (GlobalVariable * globalVar = dyn_cast<GlobalVariable>(object)) {
+        // the definition may be replaced by one of a different size at link time
+        if (globalVar->isDeclaration() || globalVar->mayBeOverridden()) {
+            return false;
+        }
+        objectSize = DL_->getTypeAllocSize(globalVar->getType()->getElementType());
+    } else {
+        return false;
+    }
+
+    return IsNotLess(Begin, Expr(0L)) && IsNotLess(Expr((long)objectSize), End);
+}
+
+void RangedAddressSanitizer::eliminateRedundantChecks(std::map<BasicBlock*, std::vector<CallInfo> > & nestCalls,
+                                                      std::map<BasicBlock*, std::vector<Value*> > & nestChecks)
+{
+  // Nests are visited in dominator tree order, so the checks of a dominating nest have been
+  // resolved (and possibly folded themselves) by the time they are used.
+    std::vector<BasicBlock*> visitedNests;
+    for (auto itNode = df_begin(DT_->getRootNode()); itNode != df_end(DT_->getRootNode()); ++itNode) {
+        BasicBlock * Preheader = (*itNode)->getBlock();
+        auto itNest = nestCalls.find(Preheader);
+        if (itNest == nestCalls.end()) {
+            continue;
+        }
+
+        std::vector<CallInfo> & calls = itNest->second;
+        std::vector<Value*> & checks = nestChecks[Preheader];
+        for (unsigned i = 0; i < calls.size(); ++i) {
+            const CallInfo & CI = calls[i];
+            Value * covering = nullptr;
+
+            for (BasicBlock * domPreheader : visitedNests) {
+                if (!DT_->dominates(domPreheader, Preheader)) {
+                    continue;
+                }
+
+                std::vector<CallInfo> & domCalls = nestCalls[domPreheader];
+                for (unsigned j = 0; j < domCalls.size() && !covering; ++j) {
+                    const CallInfo & domCI = domCalls[j];
+                    Value * domCheck = nestChecks[domPreheader][j];
+                    if (domCI.Array == CI.Array &&
+                        IsNotLess(CI.MinEx, domCI.MinEx) && IsNotLess(domCI.MaxEx, CI.MaxEx) &&
+                        !MayFreeBetween(cast<Instruction>(domCheck)->getParent(), Preheader)) {
+                        covering = domCheck;
+                    }
+                }
+                if (covering) {
+                    break;
+                }
+            }
+
+            if (covering) {
+                SPM_DEBUG( dbgs() << "FASan: " << *checks[i] << " is covered by " << *covering << "\n" );
+                Instruction * redundant = cast<Instruction>(checks[i]);
+                redundant->replaceAllUsesWith(covering);
+                redundant->eraseFromParent();
+                checks[i] = covering;
+            }
+        }
+
+        visitedNests.push_back(Preheader);
+    }
+}
+
 void RangedAddressSanitizer::ii_visitLoop(Loop * loop)
 {
     for (Loop * childLoop : *loop) {
@@ -200,25 +605,246 @@ void RangedAddressSanitizer::ii_visitLoop(Loop * loop)
 }
 
 
-void RangedAddressSanitizer::markSafeArrayUse(Instruction * inst, Value * array)
+BasicBlock * RangedAddressSanitizer::cloneSafeNest(Function &F, BasicBlock * Preheader, Loop * finalLoop,
+                                                   Value * allSafe, const std::set<Instruction*> & proven,
+                                                   ValueToValueMapTy & cloneMap)
 {
-	Value * usedArray;
-	Expr subscript;
-	unsigned size;
-#if 1
-	if (reduceMemoryAccess(inst, usedArray, subscript, size)) {
-		SPM_DEBUG( dbgs() << "FASan: will not check " << *inst << "\n" );
-		safeUseSet.insert(inst);
-	}
-#else
-	Value * ptr = 0;
-	if (LoadInst * loadInst = dyn_cast<LoadInst>(&inst)) {
-		ptr = loadInst->getPointerOperand();
+    Loop::block_iterator itBodyBlock,S,E;
+    S = finalLoop->block_begin();
+    E = finalLoop->block_end();
 
-	} else if (StoreInst * storeInst = dyn_cast<StoreInst>(&inst)) {
-		ptr = storeInst->getPointerOperand();
-	}
-#endif
+  // clone loop body (cloned loop will run unchecked)
+    BasicBlock * clonedHeader = 0;
+    std::vector<BasicBlock*> clonedBlocks;
+
+    for (itBodyBlock = S;itBodyBlock != E; ++itBodyBlock) {
+
+        const BasicBlock * bodyBlock = *itBodyBlock;
+        BasicBlock * clonedBlock = CloneBasicBlock(bodyBlock, cloneMap, "_checked", &F, 0);
+
+        cloneMap[bodyBlock] = clonedBlock;
+        clonedBlocks.push_back(clonedBlock);
+
+        if (bodyBlock == finalLoop->getHeader()) {
+            clonedHeader = clonedBlock;
+            SPM_DEBUG( dbgs() << "FASan: loop header case at " << bodyBlock->getName() << "\n" );
+        } else {
+            SPM_DEBUG( dbgs() << "FASan: non-header block at " << bodyBlock->getName() << "\n" );
+        }
+    }
+
+    if (!clonedHeader) {
+        // TODO run clean-up code
+        SPM_DEBUG( dbgs() << "FASan: could not find header!\n");
+        abort();
+    }
+
+  // Remap uses inside cloned region
+    for (BasicBlock * block : clonedBlocks) {
+        for(auto & inst : *block) {
+            RemapInstruction(&inst, cloneMap, RF_IgnoreMissingEntries);
+        }
+    }
+
+  // Only the accesses whose ranges are covered by the checks run unguarded
+    for (Instruction * inst : proven) {
+        if (Value * clonedInst = cloneMap.lookup(inst)) {
+            SPM_DEBUG( dbgs() << "FASan: will not check " << *clonedInst << "\n" );
+            safeUseSet.insert(clonedInst);
+        }
+    }
+
+  // Accesses that are statically in bounds stay unchecked in the clone as well
+    for (itBodyBlock = S; itBodyBlock != E; ++itBodyBlock) {
+        for (auto & inst : **itBodyBlock) {
+            if (safeUseSet.count(&inst)) {
+                safeUseSet.insert(cloneMap.lookup(&inst));
+            }
+        }
+    }
+
+   // TODO fix PHI-nodes in exit blocks
+
+   // Rewire terminator of the range check to branch to the cloned region
+    TerminatorInst * checkTermInst = Preheader->getTerminator();
+
+    if (BranchInst * checkBranchInst = dyn_cast<BranchInst>(checkTermInst)) {
+        if (checkBranchInst->isUnconditional()) {
+            BasicBlock * defTarget = checkBranchInst->getSuccessor(0);
+            BranchInst * modifiedBranchInst = BranchInst::Create(clonedHeader, defTarget, allSafe, checkBranchInst);
+            checkBranchInst->replaceAllUsesWith(modifiedBranchInst);
+            checkBranchInst->eraseFromParent();
+        } else {
+            SPM_DEBUG( dbgs() << "FASan: Unexpected conditional branch (preheader should branch unconditional) " << * checkTermInst << "\n" );
+            abort();
+        }
+    } else {
+        SPM_DEBUG( dbgs() << "FASan: unsupported terminator type " << * checkTermInst << "\n" );
+        abort();
+    }
+
+    return clonedHeader;
+}
+
+long RangedAddressSanitizer::getSplitCoeff(Loop * finalLoop, Expr Subscript)
+{
+    PHINode * indVar;
+    Expr indStart, indEnd, indStep;
+    if (!LIE_->getLoopInfo(finalLoop, indVar, indStart, indEnd, indStep) ||
+        !indStep.isInteger() || indStep.getInteger() != 1) {
+        return 0;
+    }
+
+    Expr indEx(indVar);
+    Expr coeffEx = Subscript.coeff(indEx);
+    if (Subscript.degree(indEx) != 1 || !coeffEx.isInteger()) {
+        return 0;
+    }
+
+  // The remaining terms must span the same range in every iteration of finalLoop:
+  // they may only depend on invariants and on inner induction variables with invariant bounds.
+    for (auto & symbol : Subscript.getSymbols()) {
+        Value * symbolValue = symbol.getSymbolValue();
+        if (symbolValue == indVar || finalLoop->isLoopInvariant(symbolValue)) {
+            continue;
+        }
+
+        PHINode * innerPhi = dyn_cast<PHINode>(symbolValue);
+        Loop * innerLoop = innerPhi ? LI_->getLoopFor(innerPhi->getParent()) : nullptr;
+        PHINode * innerVar;
+        Expr innerStart, innerEnd, innerStep;
+        if (!innerLoop || innerLoop == finalLoop || !finalLoop->contains(innerLoop) ||
+            !LIE_->getLoopInfo(innerLoop, innerVar, innerStart, innerEnd, innerStep) ||
+            innerVar != innerPhi ||
+            !LoopInfoExpr::IsLoopInvariant(finalLoop, innerStart) ||
+            !LoopInfoExpr::IsLoopInvariant(finalLoop, innerEnd)) {
+            return 0;
+        }
+    }
+
+    return coeffEx.getInteger();
+}
+
+bool RangedAddressSanitizer::splitSafeNest(Function &F, BasicBlock * Preheader, Loop * finalLoop,
+                                           const std::vector<CallInfo> & calls, const std::vector<Value*> & checks,
+                                           BasicBlock * clonedHeader, ValueToValueMapTy & cloneMap,
+                                           std::vector<CallInst*> & ToInline)
+{
+    bool hasSlope = false;
+    for (auto & CI : calls) {
+        hasSlope |= CI.Coeff != 0;
+    }
+    if (!hasSlope) {
+        return false;
+    }
+
+  // The outermost loop must count up by one in its only header PHI and none of its values may
+  // escape; the checked loop can then resume the iterations left by the clone.
+    PHINode * indVar;
+    Expr indStart, indEnd, indStep;
+    if (!LIE_->getLoopInfo(finalLoop, indVar, indStart, indEnd, indStep) ||
+        !indStep.isInteger() || indStep.getInteger() != 1) {
+        SPM_DEBUG( dbgs() << "FASan: cannot split loop without unit step\n" );
+        return false;
+    }
+
+    BasicBlock * header = finalLoop->getHeader();
+    BasicBlock * exitBlock = finalLoop->getExitBlock();
+    if (&header->front() != indVar || header->getFirstNonPHI() != indVar->getNextNode() ||
+        indVar->getNumIncomingValues() != 2 || !exitBlock || isa<PHINode>(exitBlock->front()) ||
+        indVar->getBasicBlockIndex(Preheader) < 0) {
+        SPM_DEBUG( dbgs() << "FASan: cannot split loop at " << header->getName() << "\n" );
+        return false;
+    }
+
+    for (auto itBlock = finalLoop->block_begin(); itBlock != finalLoop->block_end(); ++itBlock) {
+        for (auto & inst : **itBlock) {
+            for (auto itUse = inst.use_begin(); itUse != inst.use_end(); ++itUse) {
+                Instruction * userInst = dyn_cast<Instruction>(*itUse);
+                if (!userInst || !finalLoop->contains(userInst)) {
+                    SPM_DEBUG( dbgs() << "FASan: value escapes loop " << inst << "\n" );
+                    return false;
+                }
+            }
+        }
+    }
+
+    Expr loEx, hiEx;
+    if (!RMM_->getMinMax(Expr(indVar), loEx, hiEx) ||
+        !LoopInfoExpr::IsLoopInvariant(finalLoop, loEx) ||
+        !LoopInfoExpr::IsLoopInvariant(finalLoop, hiEx)) {
+        SPM_DEBUG( dbgs() << "FASan: no invariant bounds for " << *indVar << "\n" );
+        return false;
+    }
+
+    IntegerType * IntTy = IntegerType::getInt64Ty(*Context_);
+    PointerType * VoidPtrTy = PointerType::getInt8PtrTy(*Context_);
+    BranchInst * checkBranchInst = cast<BranchInst>(Preheader->getTerminator());
+
+  // On failure, find the last iteration K whose accesses lie in the safe part of every range
+    IRBuilder<> IRB(checkBranchInst);
+    Value * lo = loEx.getExprValue(IntTy, IRB, Module_);
+    Value * hi = hiEx.getExprValue(IntTy, IRB, Module_);
+
+    BasicBlock * splitBlock = BasicBlock::Create(*Context_, "fasan.split", &F, header);
+    IRB.SetInsertPoint(splitBlock);
+    Value * lastSafe = nullptr;
+    for (unsigned i = 0; i < calls.size(); ++i) {
+        const CallInfo & CI = calls[i];
+        Value * safeIt;
+        if (CI.Coeff == 0) {
+            safeIt = IRB.CreateSelect(checks[i], hi, IRB.CreateSub(lo, IRB.getInt64(1)));
+        } else {
+            Value * voidArray = IRB.CreateBitCast(CI.Array, VoidPtrTy);
+            std::vector<Value*> Args = { voidArray, CI.Min, CI.Max };
+            // number of bytes at the end (start) of the range that may be poisoned
+            Value * unsafeBytes;
+            if (CI.Coeff > 0) {
+                CallInst * prefix = IRB.CreateCall(SafePrefixFn_, Args);
+                ToInline.push_back(prefix);
+                unsafeBytes = IRB.CreateSub(CI.Max, prefix);
+            } else {
+                CallInst * suffix = IRB.CreateCall(SafeSuffixFn_, Args);
+                ToInline.push_back(suffix);
+                unsafeBytes = IRB.CreateSub(suffix, CI.Min);
+            }
+            long slope = CI.Coeff > 0 ? CI.Coeff : -CI.Coeff;
+            Value * unsafeIts = IRB.CreateSDiv(IRB.CreateAdd(unsafeBytes, IRB.getInt64(slope - 1)),
+                                               IRB.getInt64(slope));
+            safeIt = IRB.CreateSub(hi, unsafeIts);
+        }
+        lastSafe = lastSafe ? IRB.CreateSelect(IRB.CreateICmpSLT(safeIt, lastSafe), safeIt, lastSafe)
+                            : safeIt;
+    }
+
+    BasicBlock * cloneEntry = BasicBlock::Create(*Context_, "fasan.safe", &F, clonedHeader);
+    IRB.CreateCondBr(IRB.CreateICmpSGE(lastSafe, lo), cloneEntry, header);
+
+  // The clone runs up to iteration K: all of them if the checks passed
+    IRB.SetInsertPoint(cloneEntry);
+    PHINode * lastSafePhi = IRB.CreatePHI(IntTy, 2, "fasan.last");
+    lastSafePhi->addIncoming(hi, Preheader);
+    lastSafePhi->addIncoming(lastSafe, splitBlock);
+    IRB.CreateBr(clonedHeader);
+
+    checkBranchInst->setSuccessor(0, cloneEntry);
+    checkBranchInst->setSuccessor(1, splitBlock);
+
+    PHINode * clonedVar = cast<PHINode>(cloneMap.lookup(indVar));
+    clonedVar->setIncomingBlock(clonedVar->getBasicBlockIndex(Preheader), cloneEntry);
+    indVar->setIncomingBlock(indVar->getBasicBlockIndex(Preheader), splitBlock);
+
+  // Past K, the cloned header hands the induction variable over to the checked loop
+    BasicBlock * clonedBody = clonedHeader->splitBasicBlock(clonedHeader->getFirstNonPHI(), "fasan.body");
+    TerminatorInst * headerTermInst = clonedHeader->getTerminator();
+    IRB.SetInsertPoint(headerTermInst);
+    Value * pastSafe = IRB.CreateICmpSGT(IRB.CreateSExt(clonedVar, IntTy), lastSafePhi);
+    IRB.CreateCondBr(pastSafe, header, clonedBody);
+    headerTermInst->eraseFromParent();
+    indVar->addIncoming(clonedVar, clonedHeader);
+
+    SPM_DEBUG( dbgs() << "FASan: split iteration space of loop at " << header->getName() << "\n" );
+    return true;
 }
 
 bool RangedAddressSanitizer::runOnFunction(Function &F) {
@@ -235,6 +861,7 @@ bool RangedAddressSanitizer::runOnFunction(Function &F) {
     RE_  = &getAnalysis<RelativeExecutions>();
 #endif
     RMM_ = &getAnalysis<RelativeMinMax>();
+    LIE_ = &getAnalysis<LoopInfoExpr>();
 
     Module_  = F.getParent();
     Context_ = &Module_->getContext();
@@ -281,6 +908,7 @@ bool RangedAddressSanitizer::runOnFunction(Function &F) {
   }
 
   Calls_.clear();
+  ProvenAccesses_.clear();
 
   SPM_DEBUG(dbgs() << "RangedAddressSanitizer: processing function "
                    << F.getName() << "\n");
@@ -292,6 +920,13 @@ bool RangedAddressSanitizer::runOnFunction(Function &F) {
   ReuseFnDestroy_ =
     F.getParent()->getOrInsertFunction("__spm_give", ReuseFnType);
 
+  std::vector<Type*> SafePartFormals = { VoidPtrTy, IntTy, IntTy };
+  FunctionType *SafePartFnType = FunctionType::get(IntTy, SafePartFormals, false);
+  SafePrefixFn_ =
+    F.getParent()->getOrInsertFunction("__fasan_safe_prefix", SafePartFnType);
+  SafeSuffixFn_ =
+    F.getParent()->getOrInsertFunction("__fasan_safe_suffix", SafePartFnType);
+
 // Visit all loops in bottom-up order (innter-most loops first)
   std::set<BasicBlock*> Processed;
   auto Entry = DT_->getRootNode();
@@ -326,142 +961,64 @@ bool RangedAddressSanitizer::runOnFunction(Function &F) {
 
   // FAsan logic goes here
 
-  std::map<const BasicBlock*,BasicBlock*> clonedBlockMap; // keeps track of cloned regions to avoid redundant cloning
+  // Group the range checks by nest: all arrays of a nest are checked at once
+  // and guard a single unchecked clone.
+  std::map<BasicBlock*, std::vector<CallInfo> > nestCalls;
+  for (auto &CI : Calls_) {
+    nestCalls[CI.Preheader].push_back(CI);
+  }
+
+  if (ClCostModel) {
+    selectProfitableNests(F, nestCalls);
+  }
+
+  // insert range checks
+  std::map<BasicBlock*, std::vector<Value*> > nestChecks;
+  for (auto &nest : nestCalls) {
+    IRBuilder<> IRB(nest.first->getTerminator());
+    for (auto &CI : nest.second) {
+      Value *VoidArray = IRB.CreateBitCast(CI.Array, VoidPtrTy);
+      std::vector<Value*> Args = { VoidArray, CI.Min, CI.Max, CI.Reuse };
+      CallInst *CR = IRB.CreateCall(ReuseFn_, Args);
+      nestChecks[nest.first].push_back(CR);
+      SPM_DEBUG(dbgs() << "RangedAddressSanitizer: call instruction: " << *CR
+                       << "\n");
+    }
+  }
+
+  if (ClElimRedundant) {
+    eliminateRedundantChecks(nestCalls, nestChecks);
+  }
 
   std::vector<CallInst*> ToInline;
 
-  for (auto &CI : Calls_) {
-    BasicBlock * Preheader = CI.Preheader;
-    
-  // TODO decide whether it is worthwhile to optimize for this case
+  for (auto &nest : nestCalls) {
+    BasicBlock * Preheader = nest.first;
+    Loop * finalLoop = nest.second.front().FinalLoop;
+    const std::vector<Value*> & checks = nestChecks[Preheader];
 
-  // insert range check
     IRBuilder<> IRB(Preheader->getTerminator());
-    Value *VoidArray = IRB.CreateBitCast(CI.Array, VoidPtrTy);
-    std::vector<Value*> Args = { VoidArray, CI.Min, CI.Max, CI.Reuse };
-    CallInst *CR = IRB.CreateCall(ReuseFn_, Args);
-    ToInline.push_back(CR);
-    
- // verify if this loop was already instrumented
-    TerminatorInst * preHeaderTerm = CR->getParent()->getTerminator();
-    BranchInst * preHeaderBranch = dyn_cast<BranchInst>(preHeaderTerm);
-
-    if (preHeaderBranch && preHeaderBranch->isConditional()) {
-
-    // discover the structure of the instrumented code (safe and default region)
-    // abort, if this does not look like instrumented code
-    	BasicBlock * firstTarget = preHeaderBranch->getSuccessor(0);
-    	BasicBlock * secondTarget = preHeaderBranch->getSuccessor(1);
-    	BasicBlock * safeHeader, * defHeader;
-    	if (clonedBlockMap.count(firstTarget)) {
-    		defHeader = firstTarget;
-    		safeHeader = clonedBlockMap[firstTarget];
-    		assert(safeHeader == secondTarget);
-    	} else {
-    		assert(clonedBlockMap.count(secondTarget));
-    		defHeader = secondTarget;
-			safeHeader = clonedBlockMap[secondTarget];
-			assert(safeHeader == firstTarget);
-    	}
-
-    	SPM_DEBUG( dbgs() << "FASan: (Unsupported) second array in safe region controlled by " << * preHeaderBranch << "\n" );
-    	Loop * defLoop = LI_->getLoopFor(defHeader);
-    	assert(defLoop && "default region is not a loop!");
-
-		Loop::block_iterator itBodyBlock,S,E;
-		S = defLoop->block_begin();
-		E = defLoop->block_end();
-
-	// mark accesses in cloned region as safe
-    	for (itBodyBlock = S;itBodyBlock != E; ++itBodyBlock) {
-    		BasicBlock * defBodyBlock = *itBodyBlock;
-    		BasicBlock * safeBodyBlock = clonedBlockMap[defBodyBlock];
-
-    		for(auto & inst : *safeBodyBlock) {
-				markSafeArrayUse(&inst, CI.Array);
-			}
-    	}
-
-    // add conjunctive test
-    	Value * oldCond = preHeaderBranch->getCondition();
-    	Value * joinedCond = IRB.CreateAnd(oldCond, CR, "allsafe");
-    	preHeaderBranch->setCondition(joinedCond);
+    Value * allSafe = nullptr;
+    for (Value * CR : checks) {
+      // checks folded into a dominating one are inlined along with it
+      CallInst * call = dyn_cast<CallInst>(CR);
+      if (call && call->getParent() == Preheader)
+        ToInline.push_back(call);
+      allSafe = allSafe ? IRB.CreateAnd(allSafe, CR, "allsafe") : CR;
+    }
 
-    } else {
+    if (ClStats) {
+      emitNestStats(IRB, F, Preheader, finalLoop, allSafe);
+    }
 
-	  // get loop
-		Loop* finalLoop = CI.FinalLoop;
-		Loop::block_iterator itBodyBlock,S,E;
-		S = finalLoop->block_begin();
-		E = finalLoop->block_end();
-
-	  // clone loop body (cloned loop will run unchecked)
-		ValueToValueMapTy cloneMap;
-
-		BasicBlock * clonedHeader = 0;
-		std::vector<BasicBlock*> clonedBlocks;
-
-		for (itBodyBlock = S;itBodyBlock != E; ++itBodyBlock) {
-
-			const BasicBlock * bodyBlock = *itBodyBlock;
-			BasicBlock * clonedBlock = CloneBasicBlock(bodyBlock, cloneMap, "_checked", &F, 0);
-
-			cloneMap[bodyBlock] = clonedBlock;
-			clonedBlockMap[bodyBlock] = clonedBlock;
-			clonedBlocks.push_back(clonedBlock);
-
-			if (bodyBlock == finalLoop->getHeader()) {
-				clonedHeader = clonedBlock;
-				SPM_DEBUG( dbgs() << "FASan: loop header case at " << bodyBlock->getName() << "\n" );
-			} else {
-				SPM_DEBUG( dbgs() << "FASan: non-header block at " << bodyBlock->getName() << "\n" );
-			}
-		}
-
-		if (!clonedHeader) {
-			// TODO run clean-up code
-			SPM_DEBUG( dbgs() << "FASan: could not find header!\n");
-			abort();
-		}
-
-	  // Remap uses inside cloned region (mark pointers in the region as unguarded)
-		for (BasicBlock * block : clonedBlocks) {
-			for(auto & inst : *block) {
-				RemapInstruction(&inst, cloneMap, RF_IgnoreMissingEntries);
-				markSafeArrayUse(&inst, CI.Array);
-			}
-		}
-
-	   // TODO fix PHI-nodes in exit blocks
-
-	   // Rewire terminator of the range check to branch to the cloned region
-		TerminatorInst * checkTermInst = CR->getParent()->getTerminator();
-
-		if (BranchInst * checkBranchInst = dyn_cast<BranchInst>(checkTermInst)) {
-			if (checkBranchInst->isUnconditional()) {
-				BasicBlock * defTarget = checkBranchInst->getSuccessor(0);
-				BranchInst * modifiedBranchInst = BranchInst::Create(clonedHeader, defTarget, CR, checkBranchInst);
-				checkBranchInst->replaceAllUsesWith(modifiedBranchInst);
-				checkBranchInst->eraseFromParent();
-			} else {
-				SPM_DEBUG( dbgs() << "FASan: Unexpected conditional branch (preheader should branch unconditional, other array checks will introduce conditional branches) " << * checkTermInst << "\n" );
-				abort();
-			}
-		} else {
-			SPM_DEBUG( dbgs() << "FASan: unsupported terminator type " << * checkTermInst << "\n" );
-			abort();
-		}
+    ValueToValueMapTy cloneMap;
+    BasicBlock * clonedHeader =
+      cloneSafeNest(F, Preheader, finalLoop, allSafe, ProvenAccesses_[Preheader], cloneMap);
+    if (ClSplit) {
+      splitSafeNest(F, Preheader, finalLoop, nest.second, checks, clonedHeader, cloneMap, ToInline);
     }
-    
-#if 0
-    IRB.SetInsertPoint(&(*CI.Final->begin()));
-    IRB.CreateCall(ReuseFnDestroy_, Args);
-#endif
-    SPM_DEBUG(dbgs() << "RangedAddressSanitizer: call instruction: " << *CR
-                     << "\n");
   }
 
-
   // inline calls
 #ifdef FASAN_INLINE_RUNTIME
   for (CallInst * call : ToInline) {
@@ -514,6 +1071,24 @@ bool RangedAddressSanitizer::generateCallFor(Loop *L, Instruction *I) {
      return false;
   }
 
+// Query array offset range
+  Expr MinEx, MaxEx;
+  if (!RMM_->getMinMax(Subscript, MinEx, MaxEx)) {
+    SPM_DEBUG(dbgs() << "RangedAddressSanitizer: could calculate min/max for "
+                        " subscript " << Subscript << "\n");
+    return false;
+  }
+  SPM_DEBUG(dbgs() << "RangedAddressSanitizer: min/max for subscript "
+                   << Subscript << ": " << MinEx << ", " << MaxEx << "\n");
+
+// Accesses that stay within a stack or global object of known size need no check at all
+  if (ClStaticBounds && isWithinObject(Array, MinEx, MaxEx + Size)) {
+    SPM_DEBUG(dbgs() << "RangedAddressSanitizer: access is statically in bounds "
+                     << *I << "\n");
+    safeUseSet.insert(I);
+    return true;
+  }
+
 #ifdef ENABLE_REUSE
   Loop *Final;
   Expr ReuseEx = RE_->getExecutionsRelativeTo(L, nullptr, Final);
@@ -569,16 +1144,6 @@ bool RangedAddressSanitizer::generateCallFor(Loop *L, Instruction *I) {
     }
   }
 
-// Query array offset range
-  Expr MinEx, MaxEx;
-  if (!RMM_->getMinMax(Subscript, MinEx, MaxEx)) {
-    SPM_DEBUG(dbgs() << "RangedAddressSanitizer: could calculate min/max for "
-                        " subscript " << Subscript << "\n");
-    return false;
-  }
-  SPM_DEBUG(dbgs() << "RangedAddressSanitizer: min/max for subscript "
-                   << Subscript << ": " << MinEx << ", " << MaxEx << "\n");
-
 // Materialize expressions in the loop header
   IRBuilder<> IRB(Preheader->getTerminator());
 #ifdef ENABLE_REUSE
@@ -587,13 +1152,14 @@ bool RangedAddressSanitizer::generateCallFor(Loop *L, Instruction *I) {
   Value *Reuse = ConstantInt::get(IntegerType::get(IRB.getContext(), 64), 0); // bogus
 #endif
   Value *Min   = MinEx.getExprValue(64, IRB, Module_);
-  Value *Max   = MaxEx.getExprValue(64, IRB, Module_);
+  Value *Max   = (MaxEx + Size).getExprValue(64, IRB, Module_); // exclusive
 
   SPM_DEBUG(dbgs() << "RangedAddressSanitizer: values for reuse, min, max: "
                    << *Reuse << ", " << *Min << ", " << *Max << "\n");
 
 // If there is already a range check for this array and loop cached, merge the intervals
-  CallInfo CI = { Final, Preheader, Exit, Array, Min, Max, Reuse };
+  long Coeff = getSplitCoeff(Final, Subscript);
+  CallInfo CI = { Final, Preheader, Exit, Array, Min, Max, Reuse, Coeff, MinEx, MaxEx + Size };
   auto Call = Calls_.insert(CI);
   
   if (!Call.second) {
@@ -606,12 +1172,19 @@ bool RangedAddressSanitizer::generateCallFor(Loop *L, Instruction *I) {
     Value *CmpMax = IRB.CreateICmp(CmpInst::ICMP_SGT, SCI.Max, CI.Max);
     SCI.Max = IRB.CreateSelect(CmpMax, SCI.Max, CI.Max);
 
+    SCI.MinEx = SCI.MinEx.min(CI.MinEx);
+    SCI.MaxEx = SCI.MaxEx.max(CI.MaxEx);
+
     SCI.Reuse = IRB.CreateAdd(SCI.Reuse, CI.Reuse);
 
+    if (SCI.Coeff != CI.Coeff)
+      SCI.Coeff = 0;
+
     Calls_.erase(SCI);
     Calls_.insert(SCI);
   }
 
+  ProvenAccesses_[Preheader].insert(I);
   return true;
 }
 
@@ -11,7 +11,10 @@
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 
+#include <map>
+#include <set>
 #include <unordered_set>
 
 using namespace llvm;
@@ -40,7 +43,7 @@ typedef std::set<const Value*> ValueSet;
  * Code after applying RangedAddressSanitizer:
  *
  * void foo(int* V, int N) {
- *  if (__fasan_check(V,0,N-1)){ // This check is O(N)
+ *  if (__fasan_check(V,0,N-1)){ // Scans the O(N/8) shadow bytes of the range
  *    for(int i = 0; i < N-1; i++){
  *      //The following operation has no bounds checks
  *      V[i] = V[i] + V[i+1];
@@ -54,6 +57,10 @@ typedef std::set<const Value*> ValueSet;
  * }
  *
  *
+ * If the check fails, the outermost loop is split instead: __fasan_safe_prefix (or __fasan_safe_suffix
+ * for descending accesses) bounds the iterations that only touch unpoisoned memory. These run on the
+ * unchecked loop, which then hands the induction variable over to the checked one.
+ *
  * The environment variable FASANMODULE must point to the BC-compiled code of Runtime/FASanRuntime.cpp
  * If FASAN_DISABLE is set to any value, the pass will execute without any effect
  *
@@ -92,6 +99,7 @@ private:
   ReduceIndexation   *RI_;  // Decomposes pointer based memory accesses into Array+Offset
   RelativeExecutions *RE_;  // array re-use
   RelativeMinMax     *RMM_; // induction variable bounds
+  LoopInfoExpr       *LIE_; // induction variables
   SymPyInterface     *SPI_;
 
   LLVMContext *Context_;
@@ -99,12 +107,54 @@ private:
   Constant    *FakeUseFn_;
   Constant    *ReuseFn_;
   Constant    *ReuseFnDestroy_;
+  Constant    *SafePrefixFn_;
+  Constant    *SafeSuffixFn_;
   
   ValueSet safeUseSet;
   ValueSet forcedCheckSet;
 
-  // will add inst to the safe use set, if it is a memory instruction accessing array
-  void markSafeArrayUse(Instruction * inst, Value * array);
+  // clones the nest of finalLoop; the clone runs without checks on the proven accesses
+  // whenever allSafe holds at the end of Preheader. Returns the header of the clone.
+  BasicBlock * cloneSafeNest(Function &F, BasicBlock * Preheader, Loop * finalLoop,
+                             Value * allSafe, const std::set<Instruction*> & proven,
+                             ValueToValueMapTy & cloneMap);
+
+  struct CallInfo;
+
+  // if the checks fail, runs the iterations of finalLoop whose accesses lie in the
+  // safe prefix (or suffix) of every range in the clone and resumes the checked loop
+  // after them. Calls to the runtime are added to ToInline.
+  bool splitSafeNest(Function &F, BasicBlock * Preheader, Loop * finalLoop,
+                     const std::vector<CallInfo> & calls, const std::vector<Value*> & checks,
+                     BasicBlock * clonedHeader, ValueToValueMapTy & cloneMap,
+                     std::vector<CallInst*> & ToInline);
+
+  // drops the nests whose clones do not pay off or exceed the code growth budget
+  void selectProfitableNests(Function &F, std::map<BasicBlock*, std::vector<CallInfo> > & nestCalls);
+
+  // estimated cycles saved by running the nest of finalLoop unchecked, minus the cost of
+  // its range checks
+  double estimateCloningGain(Loop * finalLoop, const std::vector<CallInfo> & calls,
+                             const std::set<Instruction*> & proven);
+
+  // estimated executions of block per entry to finalLoop
+  double estimateExecutions(Loop * finalLoop, BasicBlock * block);
+
+  // counts the entries into the nest of finalLoop in a record for __fasan_stats_count
+  void emitNestStats(IRBuilder<> & IRB, Function &F, BasicBlock * Preheader, Loop * finalLoop,
+                     Value * allSafe);
+
+  // true if [Begin, End) provably lies within the stack array or global Array points to
+  bool isWithinObject(Value * Array, Expr Begin, Expr End);
+
+  // replaces each range check by the one of a dominating nest that covers its range,
+  // unless memory may be released in between
+  void eliminateRedundantChecks(std::map<BasicBlock*, std::vector<CallInfo> > & nestCalls,
+                                std::map<BasicBlock*, std::vector<Value*> > & nestChecks);
+
+  // slope of Subscript in the induction variable of finalLoop, if it is a constant
+  // (0 otherwise)
+  long getSplitCoeff(Loop * finalLoop, Expr Subscript);
 
   // try to decompose the instruction in a base pointer plus array offset
   bool reduceMemoryAccess(Instruction * I, Value *& oArray, Expr & oSubscript, unsigned & oSize);
@@ -113,10 +163,15 @@ private:
   // the call info is stored in Calls_
   bool generateCallFor(Loop *L, Instruction *I);
 
+  // [Min, Max) is the byte range accessed relative to Array; Coeff is the slope of the
+  // subscripts in the induction variable of FinalLoop (0 if unknown or not unique) and
+  // [MinEx, MaxEx) the symbolic range
   struct CallInfo {
     Loop * FinalLoop;
     BasicBlock *Preheader, *Final;
     Value *Array, *Min, *Max, *Reuse;
+    long Coeff;
+    Expr MinEx, MaxEx;
 
     bool operator==(const CallInfo &Other) const {
       return Preheader == Other.Preheader && Array == Other.Array;
@@ -130,6 +185,9 @@ private:
   };
 
   std::unordered_set<CallInfo, CallInfoHasher> Calls_;
+
+  // accesses whose array ranges are checked in the given preheader
+  std::map<BasicBlock*, std::set<Instruction*> > ProvenAccesses_;
 };
 
 #endif /* _RANGEDADDRESSSANITIZER_H_ */
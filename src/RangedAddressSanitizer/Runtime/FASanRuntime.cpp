@@ -8,22 +8,74 @@
 // #include <unordered_set>
 #endif
 
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef __DEBUG__
 #define SPMR_DEBUG(X) X
 #else
 #define SPMR_DEBUG(X)
 #endif
 
+// Execution counts of a loop nest, emitted by the pass with -fasan-stats. The
+// layout must match the record built by RangedAddressSanitizer.
+struct FASanNestStats {
+  const char *Name;           // function:header
+  long ProvenAccesses;        // accesses that run unchecked in the clone
+  long SafeEntries;           // entries into the unchecked clone
+  long CheckedEntries;        // entries into the checked loop
+  long ScannedBytes;          // bytes whose shadow the range checks scanned
+  FASanNestStats *Next;
+  long Registered;
+};
+
 extern "C" {
   // void __spm_init();
   // void __spm_end();
   bool __fasan_check (void *Array, long Start, long End, long Reuse);
+
+  // largest P such that [Start, P) is safe, and smallest S such that
+  // [S, End) is safe
+  long __fasan_safe_prefix (void *Array, long Start, long End);
+  long __fasan_safe_suffix (void *Array, long Start, long End);
   
   // will be treated like a memory access by AddressSanitizer
   void __fasan_touch (char*Ptr);
   
   // will return true, if the address at Ptr is unpoisoned
   bool __fasan_verify (char*Ptr);
+
+  // will be replaced by the address of the shadow byte of Ptr
+  char * __fasan_shadow (char*Ptr);
+
+  // ASan allocator interface: whether Ptr is the beginning of a live heap
+  // chunk, and the size requested for it
+  int __asan_get_ownership (const void*Ptr);
+  unsigned long __asan_get_allocated_size (const void*Ptr);
+
+  // called by the ASan allocator whenever heap memory is freed
+  void __asan_free_hook (void*Ptr);
+
+  // incremented on every free; cached heap ranges of older epochs are stale
+  unsigned long __fasan_epoch = 1;
+
+  // counts an entry into a nest, along with the bytes scanned by the checks
+  // since the last entry; the nests seen so far are reported at exit (to the
+  // file named by FASAN_STATS, or stderr)
+  void __fasan_stats_count (void *Stats, bool Safe);
+  void __fasan_stats_dump ();
+
+  FASanNestStats *__fasan_stats_list = 0;
+  long __fasan_stats_atexit = 0;
+
+  // bytes whose shadow __fasan_check scanned in this thread, not yet counted
+  __thread long __fasan_scanned_bytes = 0;
   
   //void __spm_give(void *Array, long Start, long End, long Reuse);
 }
@@ -31,6 +83,131 @@ extern "C" {
 const double __spm_ReuseConstant = 200.0;
 const double __spm_CacheConstant = 0.1;
 
+// ASan's default mapping: one shadow byte per 8 application bytes. A shadow
+// byte of 0 marks a fully addressable granule, K in [1, 7] one whose first K
+// bytes are addressable, and negative values poisoned memory.
+const long SHADOW_SCALE       = 3;
+const long SHADOW_GRANULARITY = (1 << SHADOW_SCALE);
+
+// Helpers must be inlined into the entry points, as only these are copied into
+// the instrumented module: __fasan_check, __fasan_safe_prefix and
+// __fasan_safe_suffix are cloned, __asan_free_hook and (with -fasan-stats)
+// the __fasan_stats_* functions are copied as weak definitions.
+#define FASAN_INLINE static inline __attribute__((always_inline))
+
+#if defined(__AVX2__)
+typedef __m256i ShadowVec;
+const long SHADOW_VEC_SIZE = 32;
+
+FASAN_INLINE ShadowVec LoadShadow(const char *P) {
+  return _mm256_load_si256(reinterpret_cast<const __m256i*>(P));
+}
+FASAN_INLINE ShadowVec OrShadow(ShadowVec A, ShadowVec B) {
+  return _mm256_or_si256(A, B);
+}
+FASAN_INLINE bool IsZeroShadowVec(ShadowVec V) {
+  return _mm256_testz_si256(V, V);
+}
+#elif defined(__SSE2__)
+typedef __m128i ShadowVec;
+const long SHADOW_VEC_SIZE = 16;
+
+FASAN_INLINE ShadowVec LoadShadow(const char *P) {
+  return _mm_load_si128(reinterpret_cast<const __m128i*>(P));
+}
+FASAN_INLINE ShadowVec OrShadow(ShadowVec A, ShadowVec B) {
+  return _mm_or_si128(A, B);
+}
+FASAN_INLINE bool IsZeroShadowVec(ShadowVec V) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(V, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+
+// Heap ranges already found safe by this thread, direct-mapped. Only ranges
+// decided by the allocator are cached: their safety only changes when the
+// chunk is freed, which bumps __fasan_epoch. Stack frames (including ASan's
+// fake stack), globals and memory poisoned by hand change without the
+// allocator noticing, so those ranges scan the shadow on every check.
+const unsigned long CHECK_CACHE_SIZE = 64;
+
+struct CheckCacheEntry {
+  void *Ary;
+  long Start, End;
+  unsigned long Epoch;
+};
+
+static __thread CheckCacheEntry CheckCache[CHECK_CACHE_SIZE];
+
+FASAN_INLINE CheckCacheEntry &GetCacheEntry(void *Ary, long Start, long End) {
+  return CheckCache[((uintptr_t)Ary >> 4 ^ Start ^ End) & (CHECK_CACHE_SIZE - 1)];
+}
+
+FASAN_INLINE bool IsCached(CheckCacheEntry &Entry, void *Ary, long Start,
+                           long End, unsigned long Epoch) {
+  return Entry.Ary == Ary && Entry.Start == Start && Entry.End == End &&
+         Entry.Epoch == Epoch;
+}
+
+// Returns true if all shadow bytes in [Begin, End) are zero.
+FASAN_INLINE bool IsZeroShadow(const char *Begin, const char *End) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  // Scalar head up to the vector alignment, so that no load crosses a page.
+  for (; Begin < End && ((uintptr_t)Begin & (SHADOW_VEC_SIZE - 1)); ++Begin)
+    if (*Begin)
+      return false;
+
+  // Four vectors per test, then single vectors.
+  for (; End - Begin >= 4*SHADOW_VEC_SIZE; Begin += 4*SHADOW_VEC_SIZE) {
+    ShadowVec V =
+      OrShadow(OrShadow(LoadShadow(Begin), LoadShadow(Begin + SHADOW_VEC_SIZE)),
+               OrShadow(LoadShadow(Begin + 2*SHADOW_VEC_SIZE),
+                        LoadShadow(Begin + 3*SHADOW_VEC_SIZE)));
+    if (!IsZeroShadowVec(V))
+      return false;
+  }
+  for (; End - Begin >= SHADOW_VEC_SIZE; Begin += SHADOW_VEC_SIZE)
+    if (!IsZeroShadowVec(LoadShadow(Begin)))
+      return false;
+#endif
+
+  for (; Begin < End; ++Begin)
+    if (*Begin)
+      return false;
+  return true;
+}
+
+// Returns true if all bytes in [Begin, End) are addressable.
+FASAN_INLINE bool IsUnpoisoned(char *Begin, char *End) {
+  if (Begin >= End)
+    return true;
+
+  uintptr_t B = (uintptr_t)Begin, E = (uintptr_t)End;
+  uintptr_t Mask = SHADOW_GRANULARITY - 1;
+  uintptr_t FirstFull = (B + Mask) & ~Mask, LastFull = E & ~Mask;
+
+  // The whole range lies strictly inside a single granule.
+  if (FirstFull > LastFull) {
+    signed char S = *__fasan_shadow(Begin);
+    return S == 0 || (long)((E - 1) & Mask) < S;
+  }
+
+  // An unaligned head needs its granule addressable up to the end, which only
+  // a zero shadow byte guarantees.
+  if (B < FirstFull && *__fasan_shadow(Begin))
+    return false;
+
+  if (!IsZeroShadow(__fasan_shadow((char*)FirstFull),
+                    __fasan_shadow((char*)LastFull)))
+    return false;
+
+  // An unaligned tail only needs the first E - LastFull bytes of its granule.
+  if (E > LastFull) {
+    signed char S = *__fasan_shadow((char*)LastFull);
+    return S == 0 || (long)(E - LastFull) <= S;
+  }
+  return true;
+}
+
 #if 0
 const long PAGE_EXP  = 12;
 const long PAGE_SIZE = (1 << PAGE_EXP);
@@ -155,20 +332,121 @@ static PageIntervals SPMPI;
 // static std::mutex    SPMPILock;
 #endif
 
+// Shadow bytes skipped at once by the prefix & suffix scans.
+const long SHADOW_SKIP = 64;
+
+// Returns the first poisoned byte in [Begin, End), or End.
+FASAN_INLINE char *FirstPoisoned(char *Begin, char *End) {
+  uintptr_t Mask = SHADOW_GRANULARITY - 1;
+  char *P = Begin;
+  while (P < End) {
+    if (!((uintptr_t)P & Mask) && End - P >= SHADOW_SKIP*SHADOW_GRANULARITY &&
+        IsZeroShadow(__fasan_shadow(P),
+                     __fasan_shadow(P + SHADOW_SKIP*SHADOW_GRANULARITY))) {
+      P += SHADOW_SKIP*SHADOW_GRANULARITY;
+      continue;
+    }
+
+    uintptr_t Base = (uintptr_t)P & ~Mask;
+    signed char S = *__fasan_shadow(P);
+    if (S) {
+      // Only the first S bytes of a partial granule are addressable.
+      char *Bad = (char*)(Base + (S > 0 ? S : 0));
+      if (Bad < P)
+        Bad = P;
+      if (Bad < (char*)(Base + SHADOW_GRANULARITY))
+        return Bad < End ? Bad : End;
+    }
+    P = (char*)(Base + SHADOW_GRANULARITY);
+  }
+  return End;
+}
+
+// Returns the byte after the last poisoned byte in [Begin, End), or Begin.
+FASAN_INLINE char *AfterLastPoisoned(char *Begin, char *End) {
+  uintptr_t Mask = SHADOW_GRANULARITY - 1;
+  char *P = End;
+  while (P > Begin) {
+    if (!((uintptr_t)P & Mask) && P - Begin >= SHADOW_SKIP*SHADOW_GRANULARITY &&
+        IsZeroShadow(__fasan_shadow(P - SHADOW_SKIP*SHADOW_GRANULARITY),
+                     __fasan_shadow(P))) {
+      P -= SHADOW_SKIP*SHADOW_GRANULARITY;
+      continue;
+    }
+
+    uintptr_t Base = (uintptr_t)(P - 1) & ~Mask;
+    signed char S = *__fasan_shadow(P - 1);
+    if (S < 0 || (S > 0 && (uintptr_t)(P - 1) >= Base + S))
+      return P;
+    P = (char*)Base;
+  }
+  return Begin;
+}
+
+long __fasan_safe_prefix(void* Ary, long Start, long End)
+{
+    if (End <= Start || IsCached(GetCacheEntry(Ary, Start, End), Ary, Start, End, __fasan_epoch)) {
+        return End;
+    }
+
+    // the chunk is addressable up to its requested size
+    if (Start >= 0 && __asan_get_ownership(Ary)) {
+        long Size = __asan_get_allocated_size(Ary);
+        return End <= Size ? End : (Start <= Size ? Size : Start);
+    }
+
+    char * rawAry = reinterpret_cast<char*>(Ary);
+    return FirstPoisoned(rawAry + Start, rawAry + End) - rawAry;
+}
+
+long __fasan_safe_suffix(void* Ary, long Start, long End)
+{
+    if (End <= Start || IsCached(GetCacheEntry(Ary, Start, End), Ary, Start, End, __fasan_epoch)) {
+        return Start;
+    }
+
+    // the bytes past the chunk are poisoned, so no suffix of such a range is safe
+    if (Start >= 0 && __asan_get_ownership(Ary)) {
+        return (unsigned long)End <= __asan_get_allocated_size(Ary) ? Start : End;
+    }
+
+    char * rawAry = reinterpret_cast<char*>(Ary);
+    return AfterLastPoisoned(rawAry + Start, rawAry + End) - rawAry;
+}
+
 // FIXME Does "End" really point to the last byte used in the array access
 bool __fasan_check(void* Ary, long Start, long End, long Reuse)
 {
-    char * rawAry = reinterpret_cast<char*>(Ary);
-    for (long i = Start;i < End; i+= 4) {
-#if 0
-        __fasan_touch(rawAry + i); // TODO replace by shadow map query
-#else
-        if (__fasan_verify(rawAry + i)) {
+    if (End <= Start) {
+        return true;
+    }
+
+    // The epoch is read first, so that a free during the check invalidates
+    // the entry stored below.
+    unsigned long Epoch = __fasan_epoch;
+    CheckCacheEntry & Entry = GetCacheEntry(Ary, Start, End);
+    if (IsCached(Entry, Ary, Start, End, Epoch)) {
+        return true;
+    }
+
+    // Heap arrays are checked in constant time against the chunk they start;
+    // pointers into the middle of a chunk, stack and globals scan the shadow.
+    if (Start >= 0 && __asan_get_ownership(Ary)) {
+        if ((unsigned long)End > __asan_get_allocated_size(Ary)) {
             return false;
         }
-#endif
-    }    
-    return true;
+        Entry.Ary   = Ary;
+        Entry.Start = Start;
+        Entry.End   = End;
+        Entry.Epoch = Epoch;
+        return true;
+    }
+
+    // only scans are counted: cache hits and heap chunks take constant time
+    __fasan_scanned_bytes += End - Start;
+
+    char * rawAry = reinterpret_cast<char*>(Ary);
+    return IsUnpoisoned(rawAry + Start, rawAry + End);
     
 #if 0    
     return End > Start;
@@ -186,3 +464,49 @@ bool __fasan_check(void* Ary, long Start, long End, long Reuse)
 #endif
 }
 
+void __asan_free_hook(void*)
+{
+    __sync_fetch_and_add(&__fasan_epoch, 1);
+}
+
+void __fasan_stats_count(void* Stats, bool Safe)
+{
+    FASanNestStats * Nest = reinterpret_cast<FASanNestStats*>(Stats);
+
+    // link the nest into the report on its first entry
+    if (!Nest->Registered && __sync_bool_compare_and_swap(&Nest->Registered, 0, 1)) {
+        FASanNestStats * Head;
+        do {
+            Head = __fasan_stats_list;
+            Nest->Next = Head;
+        } while (!__sync_bool_compare_and_swap(&__fasan_stats_list, Head, Nest));
+
+        if (__sync_bool_compare_and_swap(&__fasan_stats_atexit, 0, 1)) {
+            atexit(__fasan_stats_dump);
+        }
+    }
+
+    __sync_fetch_and_add(Safe ? &Nest->SafeEntries : &Nest->CheckedEntries, 1);
+    // the checks of the nest ran in this thread right before its entry
+    __sync_fetch_and_add(&Nest->ScannedBytes, __fasan_scanned_bytes);
+    __fasan_scanned_bytes = 0;
+}
+
+void __fasan_stats_dump()
+{
+    const char * Path = getenv("FASAN_STATS");
+    FILE * Out = Path ? fopen(Path, "a") : 0;
+    if (!Out) {
+        Out = stderr;
+    }
+
+    fprintf(Out, "nest,safe_entries,checked_entries,scanned_bytes,proven_accesses\n");
+    for (FASanNestStats * Nest = __fasan_stats_list; Nest; Nest = Nest->Next) {
+        fprintf(Out, "%s,%ld,%ld,%ld,%ld\n", Nest->Name, Nest->SafeEntries,
+                Nest->CheckedEntries, Nest->ScannedBytes, Nest->ProvenAccesses);
+    }
+
+    if (Out != stderr) {
+        fclose(Out);
+    }
+}
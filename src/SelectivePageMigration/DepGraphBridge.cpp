@@ -0,0 +1,36 @@
+//===------------------------- DepGraphBridge.cpp -------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "DepGraphBridge.h"
+
+#include "llvm/PassRegistry.h"
+
+using namespace llvm;
+
+// Defined in DepGraph.so (DepGraph/DepGraphShim.cpp).
+extern "C" int DepGraph_GetValueSetKey(Pass *AS, Value *V);
+extern "C" Instruction *DepGraph_GetTripCount(Pass *TCA, BasicBlock *Header);
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+static AnalysisID GetPassID(const char *Name) {
+  const PassInfo *PI = PassRegistry::getPassRegistry()->getPassInfo(Name);
+  return PI ? PI->getTypeInfo() : nullptr;
+}
+
+AnalysisID GetAliasSetsID() {
+  return GetPassID("alias-sets");
+}
+
+int GetValueSetKey(Pass *AS, Value *V) {
+  return DepGraph_GetValueSetKey(AS, V);
+}
+
+AnalysisID GetTripCountAnalysisID() {
+  return GetPassID("tc-analysis");
+}
+
+Instruction *GetTripCount(Pass *TCA, BasicBlock *Header) {
+  return DepGraph_GetTripCount(TCA, Header);
+}
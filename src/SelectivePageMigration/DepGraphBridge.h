@@ -0,0 +1,28 @@
+#ifndef _DEPGRAPHBRIDGE_H_
+#define _DEPGRAPHBRIDGE_H_
+
+#include "llvm/Pass.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Value.h"
+
+// Bridge to the DepGraph analyses SPM can use. DepGraph.so is only loaded
+// when one of them is requested, so SPM must not refer to their pass IDs:
+// the passes are looked up by name and queried through C entry points in
+// DepGraph.so.
+
+// Returns the ID of DepGraph's AliasSets, or null if DepGraph.so has not been
+// loaded.
+llvm::AnalysisID GetAliasSetsID();
+
+// Returns the alias set V belongs to, or 0 if it is in none.
+int GetValueSetKey(llvm::Pass *AS, llvm::Value *V);
+
+// Returns the ID of DepGraph's TripCountAnalysis, or null if DepGraph.so has
+// not been loaded.
+llvm::AnalysisID GetTripCountAnalysisID();
+
+// Returns the trip count estimated for the loop headed by Header, or null.
+llvm::Instruction *GetTripCount(llvm::Pass *TCA, llvm::BasicBlock *Header);
+
+#endif
@@ -10,8 +10,10 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
 
 #include "ginac/ginac.h"
+#include <algorithm>
 #include <sstream>
 #include <unordered_map>
 
@@ -21,15 +23,23 @@ using namespace llvm;
 /* ************************************************************************** */
 
 static cl::opt<bool>
-  ClDebug("expr-debug",
+  ClDebug("spm-expr-debug",
           cl::desc("Enable debugging for value-generating functions"),
           cl::Hidden, cl::init(false));
 
+static cl::opt<unsigned>
+  ClOutlineThreshold("expr-outline-threshold",
+                     cl::desc("Move the code for expressions with more nodes "
+                              "than this into a cold function (0 disables)"),
+                     cl::Hidden, cl::init(64));
+
 #define EXPR_DEBUG(X) { if (ClDebug) { X; } }
 
 /* ************************************************************************** */
 /* ************************************************************************** */
 
+namespace spm {
+
 raw_ostream& operator<<(raw_ostream& OS, const GiNaC::ex &E) {
   std::ostringstream Str;
   Str << E;
@@ -44,9 +54,30 @@ raw_ostream& operator<<(raw_ostream& OS, const Expr &EI) {
   return OS;
 }
 
+} // end namespace spm
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+static GiNaC::ex ilog2_eval(const GiNaC::ex &X) {
+  if (!GiNaC::is_a<GiNaC::numeric>(X) ||
+      !GiNaC::ex_to<GiNaC::numeric>(X).is_integer())
+    return ilog2(X).hold();
+
+  GiNaC::numeric N = GiNaC::ex_to<GiNaC::numeric>(X);
+  long Log = 0;
+  for (; N > 1; ++Log)
+    N = GiNaC::iquo(N, 2);
+  return Log;
+}
+
+REGISTER_FUNCTION(ilog2, eval_func(ilog2_eval))
+
 /* ************************************************************************** */
 /* ************************************************************************** */
 
+namespace spm {
+
 Expr ExprMap::operator[](const Expr& Ex) {
   return Expr(Map_[Ex.getExpr()]);
 }
@@ -168,6 +199,11 @@ bool Expr::isMax() const {
          GiNaC::ex_to<GiNaC::function>(Expr_).get_name() == "max";
 }
 
+bool Expr::isILog2() const {
+  return GiNaC::is_a<GiNaC::function>(Expr_) &&
+         GiNaC::ex_to<GiNaC::function>(Expr_).get_name() == "ilog2";
+}
+
 bool Expr::isConstant() const {
   return GiNaC::is_a<GiNaC::numeric>(Expr_);
 }
@@ -237,6 +273,17 @@ Expr Expr::getPowExp() const {
   return at(1);
 }
 
+int Expr::degree(Expr Sym) const {
+  GiNaC::ex Expanded = Expr_.expand();
+  if (!Expanded.is_polynomial(Sym.getExpr()))
+    return -1;
+  return Expanded.degree(Sym.getExpr());
+}
+
+Expr Expr::coeff(Expr Sym, int N) const {
+  return Expr_.expand().coeff(Sym.getExpr(), N);
+}
+
 Value *Expr::getSymbolValue() const {
   return Values[GiNaC::ex_to<GiNaC::symbol>(Expr_).get_name()];
 }
@@ -267,14 +314,26 @@ Value *Expr::getValue(unsigned BitWidth, LLVMContext &C,
   return getValue(IntegerType::get(C, BitWidth), IRB);
 }
 
-Value *Expr::getExprValue(unsigned BitWidth, IRBuilder<> &IRB,
-                          Module *M) const {
+Value *Expr::getExprValue(unsigned BitWidth, IRBuilder<> &IRB, Module *M,
+                          ExprValueCache *Cache) const {
   IntegerType *Ty = IntegerType::get(M->getContext(), BitWidth);
-  return getExprValue(Ty, IRB, M);
+  return getExprValue(Ty, IRB, M, Cache);
 }
 
-Value *Expr::getExprValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M) const {
-  LLVMContext &C = M->getContext();
+Value *Expr::getExprValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M,
+                          ExprValueCache *Cache) const {
+  return emitValue(Ty, IRB, M, Cache, ClOutlineThreshold != 0);
+}
+
+static unsigned GetNumNodes(const GiNaC::ex &Ex) {
+  unsigned Num = 0;
+  for (auto It = Ex.preorder_begin(), E = Ex.preorder_end(); It != E; ++It)
+    ++Num;
+  return Num;
+}
+
+Value *Expr::emitValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M,
+                       ExprValueCache *Cache, bool Outline) const {
   // Stop recursion when the expression is a single atom - a symbol or a
   // constant.
   if (isSymbol() || isConstant()) {
@@ -282,21 +341,22 @@ Value *Expr::getExprValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M) const {
     EXPR_DEBUG(dbgs() << "SelectivePageMigration: value for " << Expr_
                       << " is: " << *V << "\n");
     return V;
-  } else if (isPow()) {
-    Value *Base = getPowBase().getExprValue(Ty, IRB, M);
-    Value *Exp  = getPowExp().getExprValue(Ty, IRB, M);
+  }
 
-    Type  *DoubleTy   = Type::getDoubleTy(C);
-    Value *BaseDouble = IRB.CreateSIToFP(Base, DoubleTy);
-    Value *ExpDouble  = IRB.CreateSIToFP(Exp,  DoubleTy);
+  BasicBlock *BB = IRB.GetInsertBlock();
+  if (Cache) {
+    if (Value *V = Cache->lookup(BB, Ty, *this)) {
+      EXPR_DEBUG(dbgs() << "SelectivePageMigration: reusing value for "
+                        << Expr_ << ": " << *V << "\n");
+      return V;
+    }
+  }
 
-    Function *PowFn = Intrinsic::getDeclaration(M, Intrinsic::pow,
-                                                ArrayRef<Type*>(DoubleTy));
-    Value *Pow = IRB.CreateCall2(PowFn, BaseDouble, ExpDouble);
-    Value *Cast = IRB.CreateFPToSI(Pow, Base->getType());
-    EXPR_DEBUG(dbgs() << "SelectivePageMigration: value for " << Expr_
-                      << " is: " << *Cast << "\n");
-    return Cast;
+  Value *Ret = nullptr;
+  if (Outline && GetNumNodes(Expr_) > ClOutlineThreshold) {
+    Ret = emitOutlinedValue(Ty, IRB, M);
+  } else if (isPow()) {
+    Ret = emitPowValue(Ty, IRB, M, Cache, Outline);
   } else if (isAdd() || isMul()) {
     bool IsAdd = isAdd(), IsMul = isMul();
     // The accumulator will keep track of the last generated expression, to be
@@ -320,34 +380,126 @@ Value *Expr::getExprValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M) const {
         }
       }
 
-      Value *Curr = SubEx.getExprValue(Ty, IRB, M);
+      Value *Curr = SubEx.emitValue(Ty, IRB, M, Cache, Outline);
       Acc = Acc ? IsAdd ? IRB.CreateAdd(Acc, Curr) : IRB.CreateMul(Acc, Curr)
                 : Curr;
     }
-    EXPR_DEBUG(dbgs() << "SelectivePageMigration: value for " << Expr_
-                      << " is: " << *Acc << "\n");
-    return Acc;
+    Ret = Acc;
   } else if (isMin()) {
-    Value *Left  = at(0).getExprValue(Ty, IRB, M);
-    Value *Right = at(1).getExprValue(Ty, IRB, M);
+    Value *Left  = at(0).emitValue(Ty, IRB, M, Cache, Outline);
+    Value *Right = at(1).emitValue(Ty, IRB, M, Cache, Outline);
     Value *Cmp = IRB.CreateICmp(CmpInst::ICMP_SLT, Left, Right);
-    Value *Ret = IRB.CreateSelect(Cmp, Left, Right);
-    EXPR_DEBUG(dbgs() << "SelectivePageMigration: value for " << Expr_
-                      << " is: " << *Ret << "\n");
-    return Ret;
+    Ret = IRB.CreateSelect(Cmp, Left, Right);
   } else if (isMax()) {
-    Value *Left  = at(0).getExprValue(Ty, IRB, M);
-    Value *Right = at(1).getExprValue(Ty, IRB, M);
+    Value *Left  = at(0).emitValue(Ty, IRB, M, Cache, Outline);
+    Value *Right = at(1).emitValue(Ty, IRB, M, Cache, Outline);
     Value *Cmp = IRB.CreateICmp(CmpInst::ICMP_SGT, Left, Right);
-    Value *Ret = IRB.CreateSelect(Cmp, Left, Right);
-    EXPR_DEBUG(dbgs() << "SelectivePageMigration: value for " << Expr_
-                      << " is: " << *Ret << "\n");
-    return Ret;
+    Ret = IRB.CreateSelect(Cmp, Left, Right);
+  } else if (isILog2()) {
+    // floor(log2(x)) == bits - 1 - ctlz(x) for x >= 1.
+    Value *X = at(0).emitValue(Ty, IRB, M, Cache, Outline);
+    Function *Ctlz = Intrinsic::getDeclaration(M, Intrinsic::ctlz, Ty);
+    Value *Log = IRB.CreateSub(ConstantInt::get(Ty, Ty->getBitWidth() - 1),
+                               IRB.CreateCall2(Ctlz, X, IRB.getFalse()));
+    Value *IsPos = IRB.CreateICmp(CmpInst::ICMP_SGT, X,
+                                  ConstantInt::get(Ty, 0));
+    Ret = IRB.CreateSelect(IsPos, Log, ConstantInt::get(Ty, 0));
   } else {
     EXPR_DEBUG(dbgs() << "SelectivePageMigration: unhandled expression: "
                       << Expr_ << "\n");
     return nullptr;
   }
+
+  EXPR_DEBUG(dbgs() << "SelectivePageMigration: value for " << Expr_
+                    << " is: " << *Ret << "\n");
+  if (Cache)
+    Cache->insert(BB, Ty, *this, Ret);
+  return Ret;
+}
+
+Value *Expr::emitPowValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M,
+                          ExprValueCache *Cache, bool Outline) const {
+  Expr BaseEx = getPowBase(), ExpEx = getPowExp();
+
+  // Non-negative integer exponents: square & multiply.
+  if (ExpEx.isInteger() && !ExpEx.isNegative()) {
+    Value *Square = BaseEx.emitValue(Ty, IRB, M, Cache, Outline);
+    Value *Acc = nullptr;
+    for (long Exp = ExpEx.getInteger(); Exp; Exp >>= 1) {
+      if (Exp & 1)
+        Acc = Acc ? IRB.CreateMul(Acc, Square) : Square;
+      if (Exp > 1)
+        Square = IRB.CreateMul(Square, Square);
+    }
+    return Acc ? Acc : ConstantInt::get(Ty, 1);
+  }
+
+  // Powers of two with a symbolic exponent: 2^(k*e) == 1 << (k*e). Negative
+  // exponents truncate to zero, as they would through the floating point
+  // path.
+  if (BaseEx.isInteger() && BaseEx.getInteger() > 1 &&
+      isPowerOf2_64(BaseEx.getInteger())) {
+    Value *Exp = ExpEx.emitValue(Ty, IRB, M, Cache, Outline);
+    Value *Log = ConstantInt::get(Ty, Log2_64(BaseEx.getInteger()));
+    Value *Shift = IRB.CreateMul(Exp, Log);
+    Value *IsNeg = IRB.CreateICmp(CmpInst::ICMP_SLT, Exp,
+                                  ConstantInt::get(Ty, 0));
+    return IRB.CreateSelect(IsNeg, ConstantInt::get(Ty, 0),
+                            IRB.CreateShl(ConstantInt::get(Ty, 1), Shift));
+  }
+
+  LLVMContext &C = M->getContext();
+  Value *Base = BaseEx.emitValue(Ty, IRB, M, Cache, Outline);
+  Value *Exp  = ExpEx.emitValue(Ty, IRB, M, Cache, Outline);
+
+  Type  *DoubleTy   = Type::getDoubleTy(C);
+  Value *BaseDouble = IRB.CreateSIToFP(Base, DoubleTy);
+  Value *ExpDouble  = IRB.CreateSIToFP(Exp,  DoubleTy);
+
+  Function *PowFn = Intrinsic::getDeclaration(M, Intrinsic::pow,
+                                              ArrayRef<Type*>(DoubleTy));
+  Value *Pow = IRB.CreateCall2(PowFn, BaseDouble, ExpDouble);
+  return IRB.CreateFPToSI(Pow, Base->getType());
+}
+
+Value *Expr::emitOutlinedValue(IntegerType *Ty, IRBuilder<> &IRB,
+                               Module *M) const {
+  LLVMContext &C = M->getContext();
+
+  // The outlined function takes every distinct symbol as an argument.
+  std::vector<Value*> Args;
+  std::vector<Type*> ArgTys;
+  for (auto &Sym : getSymbols()) {
+    Value *V = Sym.getSymbolValue();
+    if (std::find(Args.begin(), Args.end(), V) != Args.end())
+      continue;
+    Args.push_back(V);
+    ArgTys.push_back(V->getType());
+  }
+
+  FunctionType *FnTy = FunctionType::get(Ty, ArgTys, false);
+  Function *Fn = Function::Create(FnTy, GlobalValue::InternalLinkage,
+                                  "__spm_range", M);
+  Fn->addFnAttr(Attribute::Cold);
+  Fn->addFnAttr(Attribute::NoInline);
+
+  BasicBlock *Entry = BasicBlock::Create(C, "entry", Fn);
+  IRBuilder<> FnIRB(Entry);
+  ExprValueCache FnCache;
+  FnIRB.CreateRet(emitValue(Ty, FnIRB, M, &FnCache, false));
+
+  // Symbols were materialized as the caller's values; rewire them to the
+  // arguments.
+  auto Arg = Fn->arg_begin();
+  for (auto V : Args) {
+    for (auto &I : *Entry)
+      I.replaceUsesOfWith(V, Arg);
+    ++Arg;
+  }
+
+  EXPR_DEBUG(dbgs() << "SelectivePageMigration: outlined " << Expr_ << " into "
+                    << Fn->getName() << "\n");
+  return IRB.CreateCall(Fn, Args);
 }
 
 bool Expr::eq(const Expr& Other) const {
@@ -454,6 +606,21 @@ bool Expr::has(Expr Ex) const {
   return Expr_.has(Ex.getExpr());
 }
 
+Expr Expr::Parse(string Str, const map<string, Expr> &Symbols) {
+  GiNaC::symtab Table;
+  for (auto& P : Symbols)
+    Table[P.first] = P.second.getExpr();
+
+  try {
+    GiNaC::parser Parser(Table, true);
+    return Parser(Str);
+  } catch (std::exception &E) {
+    EXPR_DEBUG(dbgs() << "Expr: could not parse " << Str << ": " << E.what()
+                      << "\n");
+    return InvalidExpr();
+  }
+}
+
 Expr Expr::InvalidExpr() {
   static Expr Invalid(string("__INVALID__"));
   return Invalid;
@@ -467,3 +634,32 @@ GiNaC::ex Expr::getExpr() const {
   return Expr_;
 }
 
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+bool ExprValueCache::Key::operator<(const Key &Other) const {
+  if (BB != Other.BB)
+    return BB < Other.BB;
+  if (Ty != Other.Ty)
+    return Ty < Other.Ty;
+  return Ex.compare(Other.Ex) < 0;
+}
+
+Value *ExprValueCache::lookup(BasicBlock *BB, Type *Ty, const Expr &Ex) const {
+  Key K = { BB, Ty, Ex.getExpr() };
+  auto It = Map_.find(K);
+  return It != Map_.end() ? It->second : nullptr;
+}
+
+void ExprValueCache::insert(BasicBlock *BB, Type *Ty, const Expr &Ex,
+                            Value *V) {
+  Key K = { BB, Ty, Ex.getExpr() };
+  Map_[K] = V;
+}
+
+void ExprValueCache::clear() {
+  Map_.clear();
+}
+
+} // end namespace spm
+
@@ -4,6 +4,7 @@
 #include "llvm/IR/IRBuilder.h"
 
 #include "ginac/ginac.h"
+#include <map>
 #include <string>
 
 using namespace llvm;
@@ -12,7 +13,27 @@ using std::pair;
 using std::string;
 using std::vector;
 
+// floor(log2(X)) for X >= 1 & zero otherwise. Used for the trip counts of
+// loops with geometric induction variables.
+DECLARE_FUNCTION_1P(ilog2)
+
+// SymbolicRA defines an Expr class of its own, so ours lives in a namespace
+// of its own to keep the symbols of both modules apart.
+namespace spm {
 class Expr;
+}
+
+// Befriended by Expr.
+class SummationCache;
+spm::Expr NativeSummation(spm::Expr Summand, spm::Expr Var, spm::Expr Lower,
+                          spm::Expr Upper);
+spm::Expr NativeGeometricSummation(spm::Expr Summand, spm::Expr Var,
+                                   spm::Expr Start, spm::Expr End,
+                                   spm::Expr Ratio);
+
+namespace spm {
+
+class ExprValueCache;
 
 // Wrapper arround GiNaC::exmap. Used for expression matching.
 class ExprMap {
@@ -94,6 +115,7 @@ public:
   bool isPow()      const;
   bool isMin()      const;
   bool isMax()      const;
+  bool isILog2()    const;
   // Constants include any floating-point number, integer or rational.
   bool isConstant() const;
   bool isInteger()  const;
@@ -114,13 +136,23 @@ public:
   Expr getPowBase() const;
   Expr getPowExp()  const;
 
+  // Degree & coefficients of the expression seen as a polynomial in Sym. The
+  // degree is -1 if the expression is not a polynomial in Sym.
+  int  degree(Expr Sym)       const;
+  Expr coeff(Expr Sym, int N) const;
+
   Value *getSymbolValue() const;
 
   Value *getValue(IntegerType *Ty, IRBuilder<> &IRB) const;
   Value *getValue(unsigned BitWidth, LLVMContext &C, IRBuilder<> &IRB) const;
 
-  Value *getExprValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M)   const;
-  Value *getExprValue(unsigned BitWidth, IRBuilder<> &IRB, Module *M) const;
+  // Materializes the expression at the builder's insertion point. When a
+  // cache is given, subexpressions already generated in the same block are
+  // reused instead of emitted again.
+  Value *getExprValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M,
+                      ExprValueCache *Cache = nullptr) const;
+  Value *getExprValue(unsigned BitWidth, IRBuilder<> &IRB, Module *M,
+                      ExprValueCache *Cache = nullptr) const;
 
   bool eq        (const Expr& Other) const;
   bool ne        (const Expr& Other) const;
@@ -149,15 +181,59 @@ public:
   static Expr InvalidExpr();
   static Expr WildExpr();
 
+  // Parses Str in GiNaC syntax, binding each name in Symbols to the given
+  // expression. Returns InvalidExpr on syntax errors & unknown names.
+  static Expr Parse(string Str, const map<string, Expr> &Symbols);
+
   friend raw_ostream& operator<<(raw_ostream& OS, const Expr& EI);
   friend class ExprMap;
+  friend class ExprValueCache;
+  friend class ::SummationCache;
+  friend Expr (::NativeSummation)(Expr Summand, Expr Var, Expr Lower,
+                                  Expr Upper);
+  friend Expr (::NativeGeometricSummation)(Expr Summand, Expr Var, Expr Start,
+                                           Expr End, Expr Ratio);
 
 protected:
   GiNaC::ex getExpr() const;
 
 private:
+  Value *emitValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M,
+                   ExprValueCache *Cache, bool Outline) const;
+  Value *emitPowValue(IntegerType *Ty, IRBuilder<> &IRB, Module *M,
+                      ExprValueCache *Cache, bool Outline) const;
+  Value *emitOutlinedValue(IntegerType *Ty, IRBuilder<> &IRB,
+                           Module *M) const;
+
   GiNaC::ex Expr_;
 };
 
+// Values generated for expressions, per basic block. Blocks are assumed to be
+// filled in order at a single insertion point, so a cached value always
+// dominates later uses in the same block.
+class ExprValueCache {
+public:
+  Value *lookup(BasicBlock *BB, Type *Ty, const Expr &Ex) const;
+  void   insert(BasicBlock *BB, Type *Ty, const Expr &Ex, Value *V);
+  void   clear();
+
+private:
+  struct Key {
+    BasicBlock *BB;
+    Type *Ty;
+    GiNaC::ex Ex;
+
+    bool operator<(const Key &Other) const;
+  };
+
+  std::map<Key, Value*> Map_;
+};
+
+} // end namespace spm
+
+using spm::Expr;
+using spm::ExprMap;
+using spm::ExprValueCache;
+
 #endif
 
@@ -33,13 +33,13 @@ bool LoopInfoExpr::IsLoopInvariant(Loop *L, Expr Ex) {
 
 void LoopInfoExpr::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<LoopInfo>();
-  AU.addRequired<SymPyInterface>();
   AU.setPreservesAll();
 }
 
 bool LoopInfoExpr::runOnFunction(Function &F) {
   LI_ = &getAnalysis<LoopInfo>();
-  SPI_ = &getAnalysis<SymPyInterface>();
+  LoopInfoCache_.clear();
+  ExprCache_.clear();
   return false;
 }
 
@@ -50,8 +50,9 @@ bool LoopInfoExpr::isInductionVariable(PHINode *Phi) {
   Loop *L = LI_->getLoopFor(Phi->getParent());
   PHINode *Indvar;
   Expr IndvarStart, IndvarEnd, IndvarStep;
-  return getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep) &&
-         Phi == Indvar;
+  bool Geometric;
+  return getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep,
+                     &Geometric) && Phi == Indvar;
 }
 
 Loop *LoopInfoExpr::getLoopForInductionVariable(PHINode *Phi) {
@@ -61,11 +62,23 @@ Loop *LoopInfoExpr::getLoopForInductionVariable(PHINode *Phi) {
   Loop *L = LI_->getLoopFor(Phi->getParent());
   PHINode *Indvar;
   Expr IndvarStart, IndvarEnd, IndvarStep;
-  return getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep) &&
-         Phi == Indvar ? L : nullptr;
+  bool Geometric;
+  return getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep,
+                     &Geometric) && Phi == Indvar ? L : nullptr;
 }
 
 Expr LoopInfoExpr::getExprForLoop(Loop *L, Value *V) {
+  auto Key = std::make_pair(L, V);
+  auto It = ExprCache_.find(Key);
+  if (It != ExprCache_.end())
+    return It->second;
+
+  Expr Ex = computeExprForLoop(L, V);
+  ExprCache_[Key] = Ex;
+  return Ex;
+}
+
+Expr LoopInfoExpr::computeExprForLoop(Loop *L, Value *V) {
   if (L && L->isLoopInvariant(V))
     return Expr(V);
   else if (!L && !isa<Instruction>(V))
@@ -87,6 +100,14 @@ Expr LoopInfoExpr::getExprForLoop(Loop *L, Value *V) {
     case Instruction::UDiv:
       return getExprForLoop(L, I->getOperand(0)) /
              getExprForLoop(L, I->getOperand(1));
+    case Instruction::Shl:
+      // Shifts left by a constant are multiplications by powers of two. Right
+      // shifts round, so they are only taken as divisions when matching the
+      // step of an induction variable (see getLatchExpr).
+      if (ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(1)))
+        return getExprForLoop(L, I->getOperand(0)) *
+               (Expr(2L) ^ (unsigned)CI->getZExtValue());
+      return Expr(V);
     case Instruction::SExt:
     case Instruction::ZExt:
     case Instruction::Trunc:
@@ -102,7 +123,47 @@ Expr LoopInfoExpr::getExpr(Value *V) {
 
 bool LoopInfoExpr::
       getLoopInfo(Loop *L, PHINode *&Indvar, Expr &IndvarStart,
-                  Expr &IndvarEnd, Expr &IndvarStep) {
+                  Expr &IndvarEnd, Expr &IndvarStep, bool *Geometric) {
+  auto It = LoopInfoCache_.find(L);
+  if (It == LoopInfoCache_.end()) {
+    LoopInfoEntry Entry;
+    Entry.Indvar    = nullptr;
+    Entry.Geometric = false;
+    Entry.Found     = computeLoopInfo(L, Entry.Indvar, Entry.IndvarStart,
+                                      Entry.IndvarEnd, Entry.IndvarStep,
+                                      Entry.Geometric);
+    It = LoopInfoCache_.insert(std::make_pair(L, Entry)).first;
+  }
+
+  const LoopInfoEntry &Entry = It->second;
+  if (!Entry.Found || (Entry.Geometric && !Geometric))
+    return false;
+
+  if (Geometric)
+    *Geometric = Entry.Geometric;
+
+  Indvar      = Entry.Indvar;
+  IndvarStart = Entry.IndvarStart;
+  IndvarEnd   = Entry.IndvarEnd;
+  IndvarStep  = Entry.IndvarStep;
+  return true;
+}
+
+Expr LoopInfoExpr::getLatchExpr(Loop *L, Value *V) {
+  // i >>= K divides the induction variable by 2^K, rounding down; its step is
+  // taken to be the ratio 1/2^K.
+  BinaryOperator *BO = dyn_cast<BinaryOperator>(V);
+  if (BO && (BO->getOpcode() == Instruction::LShr ||
+             BO->getOpcode() == Instruction::AShr))
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(BO->getOperand(1)))
+      return getExprForLoop(L, BO->getOperand(0)) /
+             (Expr(2L) ^ (unsigned)CI->getZExtValue());
+  return getExprForLoop(L, V);
+}
+
+bool LoopInfoExpr::
+      computeLoopInfo(Loop *L, PHINode *&Indvar, Expr &IndvarStart,
+                      Expr &IndvarEnd, Expr &IndvarStep, bool &Geometric) {
   BasicBlock *Exit = L->getExitingBlock();
   if (!Exit)
     return false;
@@ -194,20 +255,29 @@ bool LoopInfoExpr::
         return false;
     }
 
-    ExprMap Repls;
-    Expr PhiEx(Phi), LatchIncomingEx = getExprForLoop(Toplevel, LatchIncoming),
+    ExprMap Repls, GeoRepls;
+    Expr PhiEx(Phi), LatchIncomingEx = getLatchExpr(Toplevel, LatchIncoming),
          Wild = Expr::WildExpr();
-    if (!LatchIncomingEx.match(PhiEx + Wild, Repls) || Repls.size() != 1 ||
-        Repls[Wild].has(PhiEx)) {
+    if (LatchIncomingEx.match(PhiEx + Wild, Repls) && Repls.size() == 1 &&
+        !Repls[Wild].has(PhiEx)) {
+      Geometric  = false;
+      IndvarStep = Repls[Wild];
+    } else if (LatchIncomingEx.match(PhiEx * Wild, GeoRepls) &&
+               GeoRepls.size() == 1 && GeoRepls[Wild].isConstant() &&
+               GeoRepls[Wild].isPositive() && GeoRepls[Wild] != Expr(1L)) {
+      // i *= 2, i >>= 1, i += i/2, ...: the step is the ratio between
+      // consecutive values.
+      Geometric  = true;
+      IndvarStep = GeoRepls[Wild];
+    } else {
       LIE_DEBUG(dbgs() << "LoopInfoExpr: could not determine accurate step\n");
       return false;
     }
 
-    IndvarStep = Repls[Wild];
-
     LIE_DEBUG(dbgs() << "LoopInfoExpr: induction variable, start, end, step: "
                      << *Indvar << " => (" << IndvarStart << ", " << IndvarEnd
-                     << ", +" << IndvarStep << ")\n");
+                     << ", " << (Geometric ? "*" : "+") << IndvarStep
+                     << ")\n");
     return true;
   }
 
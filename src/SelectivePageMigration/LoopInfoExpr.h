@@ -28,14 +28,34 @@ public:
   Expr getExpr(Value *V);
 
   // Returns the induction variable for the given loop & its start, end, & step.
+  // Induction variables multiplied by a constant ratio each iteration (i *= 2,
+  // i >>= 1) are only accepted when Geometric is given, in which case the
+  // step is the ratio.
   bool getLoopInfo(Loop *L, PHINode *&Indvar, Expr &IndvarStart,
-                   Expr &IndvarEnd, Expr &IndvarStep);
+                   Expr &IndvarEnd, Expr &IndvarStep,
+                   bool *Geometric = nullptr);
 
 private:
+  struct LoopInfoEntry {
+    bool Found, Geometric;
+    PHINode *Indvar;
+    Expr IndvarStart, IndvarEnd, IndvarStep;
+  };
+
+  Expr computeExprForLoop(Loop *L, Value *V);
+  // Like getExprForLoop, but also takes right shifts by a constant for
+  // divisions. Only used to match the step of an induction variable.
+  Expr getLatchExpr(Loop *L, Value *V);
+  bool computeLoopInfo(Loop *L, PHINode *&Indvar, Expr &IndvarStart,
+                       Expr &IndvarEnd, Expr &IndvarStep, bool &Geometric);
   PHINode *getSingleLoopVariantPhi(Loop *L, Expr Ex);
 
   LoopInfo *LI_;
-  SymPyInterface *SPI_;
+
+  // Per-function memoization of the queries above; both are cleared in
+  // runOnFunction.
+  map<Loop*, LoopInfoEntry> LoopInfoCache_;
+  map<pair<Loop*, Value*>, Expr> ExprCache_;
 };
 
 #endif
@@ -0,0 +1,183 @@
+//===------------------------- NativeSummation.cpp ------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "NativeSummation.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include "ginac/ginac.h"
+#include <cmath>
+
+using namespace llvm;
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+static cl::opt<bool>
+  ClDebug("native-sum-debug",
+          cl::desc("Enable debugging for the native summation engine"),
+          cl::Hidden, cl::init(false));
+
+#define NS_DEBUG(X) { if (ClDebug) { X; } }
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+// Sum of I^K for I in [0, N - 1], by Faulhaber's formula:
+//   1/(K + 1) * sum(binomial(K + 1, J) * B_J * N^(K + 1 - J), J = 0..K)
+// GiNaC's Bernoulli numbers use B_1 = -1/2, which is the convention that
+// matches a sum ending at N - 1.
+static GiNaC::ex PowerSum(unsigned K, const GiNaC::ex &N) {
+  GiNaC::ex Sum = 0;
+  for (unsigned J = 0; J <= K; ++J)
+    Sum += GiNaC::binomial(GiNaC::numeric(K + 1), GiNaC::numeric(J)) *
+           GiNaC::bernoulli(GiNaC::numeric(J)) *
+           GiNaC::pow(N, GiNaC::numeric(K + 1 - J));
+  return Sum/GiNaC::numeric(K + 1);
+}
+
+// Finds a min/max term in Ex whose arguments differ by Var or -Var plus an
+// integer term free of Var, innermost first. Point is where the arguments
+// meet; Below is the term's value for Var <= Point, Above for Var > Point.
+static bool FindMinMaxBreakpoint(const GiNaC::ex &Ex, const GiNaC::ex &V,
+                                 GiNaC::ex &Term, GiNaC::ex &Point,
+                                 GiNaC::ex &Below, GiNaC::ex &Above) {
+  for (size_t I = 0; I < Ex.nops(); ++I)
+    if (FindMinMaxBreakpoint(Ex.op(I), V, Term, Point, Below, Above))
+      return true;
+
+  if (!GiNaC::is_a<GiNaC::function>(Ex) || Ex.nops() != 2 || !Ex.has(V))
+    return false;
+  string Name = GiNaC::ex_to<GiNaC::function>(Ex).get_name();
+  if (Name != "min" && Name != "max")
+    return false;
+
+  // Diff = Slope*Var + Rest, which is <= 0 below Point if Slope is 1 and
+  // >= 0 if it is -1. Point must be an integer for the pieces to be exact.
+  GiNaC::ex Diff = (Ex.op(0) - Ex.op(1)).expand();
+  if (!Diff.is_polynomial(V) || Diff.degree(V) != 1)
+    return false;
+  GiNaC::ex Slope = Diff.coeff(V, 1), Rest = Diff.coeff(V, 0);
+  if ((!Slope.is_equal(1) && !Slope.is_equal(-1)) ||
+      !Rest.integer_content().info(GiNaC::info_flags::integer))
+    return false;
+
+  bool FirstBelow = Slope.is_equal(1) == (Name == "min");
+  Term  = Ex;
+  Point = -Slope * Rest;
+  Below = Ex.op(FirstBelow ? 0 : 1);
+  Above = Ex.op(FirstBelow ? 1 : 0);
+  return true;
+}
+
+Expr NativeSummation(Expr Summand, Expr Var, Expr Lower, Expr Upper) {
+  if (!Summand.isValid() || !Lower.isValid() || !Upper.isValid() ||
+      !Var.isSymbol())
+    return Expr::InvalidExpr();
+
+  GiNaC::ex V  = Var.getExpr();
+  GiNaC::ex Lo = Lower.getExpr();
+  GiNaC::ex Hi = Upper.getExpr();
+  if (Lo.has(V) || Hi.has(V)) {
+    NS_DEBUG(dbgs() << "NativeSummation: bounds depend on " << Var << "\n");
+    return Expr::InvalidExpr();
+  }
+
+  // Min/max terms in the bounds, or in the summand when they do not involve
+  // Var, are treated like any other symbol: the closed form below is exact
+  // whenever the range is not empty, which is also what SymPy assumes.
+  GiNaC::ex Poly = Summand.getExpr().expand();
+  if (!Poly.is_polynomial(V)) {
+    // Sum both sides of a min/max breakpoint separately. The split point is
+    // clamped to [Lo - 1, Hi], so that an empty piece sums to zero.
+    GiNaC::ex Term, Point, Below, Above;
+    if (FindMinMaxBreakpoint(Poly, V, Term, Point, Below, Above)) {
+      Expr Mid = Upper.min(Expr(Point).max(Lower - 1));
+      NS_DEBUG(dbgs() << "NativeSummation: splitting " << Summand << " at "
+                      << Var << " = " << Mid << "\n");
+      Expr SumBelow = NativeSummation(Poly.subs(Term == Below), Var, Lower,
+                                      Mid);
+      Expr SumAbove = NativeSummation(Poly.subs(Term == Above), Var, Mid + 1,
+                                      Upper);
+      if (!SumBelow.isValid() || !SumAbove.isValid())
+        return Expr::InvalidExpr();
+      return SumBelow + SumAbove;
+    }
+
+    NS_DEBUG(dbgs() << "NativeSummation: " << Summand
+                    << " is not a polynomial in " << Var << "\n");
+    return Expr::InvalidExpr();
+  }
+
+  // sum(I^K, I = Lo..Hi) = PowerSum(K, Hi + 1) - PowerSum(K, Lo).
+  GiNaC::ex Sum = 0;
+  int Degree = Poly.degree(V);
+  for (int K = 0; K <= Degree; ++K) {
+    GiNaC::ex Coeff = Poly.coeff(V, K);
+    if (Coeff.is_zero())
+      continue;
+    Sum += Coeff * (PowerSum(K, Hi + 1) - PowerSum(K, Lo));
+  }
+
+  Expr Ret = Sum.expand();
+  NS_DEBUG(dbgs() << "NativeSummation: sum(" << Summand << ", " << Var
+                  << " = " << Lower << ".." << Upper << ") = " << Ret << "\n");
+  return Ret;
+}
+
+Expr NativeGeometricSummation(Expr Summand, Expr Var, Expr Start, Expr End,
+                              Expr Ratio) {
+  if (!Summand.isValid() || !Start.isValid() || !End.isValid() ||
+      !Var.isSymbol() || !Ratio.isConstant() || !Ratio.isPositive())
+    return Expr::InvalidExpr();
+
+  GiNaC::ex V = Var.getExpr();
+  GiNaC::ex S = Start.getExpr();
+  GiNaC::ex E = End.getExpr();
+  GiNaC::ex R = Ratio.getExpr();
+  if (S.has(V) || E.has(V) || R.is_equal(1) ||
+      !GiNaC::ex_to<GiNaC::numeric>(R).is_rational())
+    return Expr::InvalidExpr();
+
+  // The trip count is 1 + log_R(E/S), as 1 + (ilog2(E) - ilog2(S))/log2(R),
+  // which is only an integer for powers of two.
+  double LogRatio = std::log2(GiNaC::ex_to<GiNaC::numeric>(R).to_double());
+  long RoundedLog = std::lround(LogRatio);
+  if (std::fabs(LogRatio - RoundedLog) > 1e-9) {
+    NS_DEBUG(dbgs() << "NativeSummation: ratio " << Ratio
+                    << " is not a power of two\n");
+    return Expr::InvalidExpr();
+  }
+
+  GiNaC::ex Poly = Summand.getExpr().expand();
+  if (!Poly.is_polynomial(V)) {
+    NS_DEBUG(dbgs() << "NativeSummation: " << Summand
+                    << " is not a polynomial in " << Var << "\n");
+    return Expr::InvalidExpr();
+  }
+
+  GiNaC::ex Trip = (ilog2(E) - ilog2(S)) * GiNaC::numeric(1, RoundedLog) + 1;
+
+  // sum((S*R^I)^K, I = 0..Trip-1) = (R^K*E^K - S^K)/(R^K - 1), taking
+  // S*R^(Trip-1) = E.
+  GiNaC::ex Sum = 0;
+  int Degree = Poly.degree(V);
+  for (int K = 0; K <= Degree; ++K) {
+    GiNaC::ex Coeff = Poly.coeff(V, K);
+    if (Coeff.is_zero())
+      continue;
+    if (K == 0) {
+      Sum += Coeff * Trip;
+    } else {
+      GiNaC::ex RK = GiNaC::pow(R, K);
+      Sum += Coeff * (RK * GiNaC::pow(E, K) - GiNaC::pow(S, K))/(RK - 1);
+    }
+  }
+
+  Expr Ret = Sum.expand();
+  NS_DEBUG(dbgs() << "NativeSummation: sum(" << Summand << ", " << Var
+                  << " = " << Start << ".." << End << ", *" << Ratio << ") = "
+                  << Ret << "\n");
+  return Ret;
+}
@@ -0,0 +1,22 @@
+#ifndef _NATIVESUMMATION_H_
+#define _NATIVESUMMATION_H_
+
+#include "Expr.h"
+
+// Closed form of the sum of Summand for Var in [Lower, Upper], computed
+// directly on GiNaC expressions. Handles summands that are polynomials in Var
+// over bounds that do not depend on it; min/max bounds are kept as opaque
+// terms. A min/max of Var+c (or c-Var) and a term free of Var is handled by
+// splitting the range where its arguments meet. Returns InvalidExpr for
+// anything else, so that the caller may fall back to a general-purpose
+// engine.
+Expr NativeSummation(Expr Summand, Expr Var, Expr Lower, Expr Upper);
+
+// Same as above for a variable that goes from Start to End multiplied by the
+// constant Ratio at each step, which must be a power of two (or the inverse of
+// one). The trip count is taken from integer logarithms, so the result is an
+// estimate unless End/Start is a power of Ratio.
+Expr NativeGeometricSummation(Expr Summand, Expr Var, Expr Start, Expr End,
+                              Expr Ratio);
+
+#endif
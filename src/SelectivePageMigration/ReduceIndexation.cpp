@@ -110,3 +110,46 @@ bool ReduceIndexation::reduceMemoryOp(Value *Ptr, Value *&Array,
   return true;
 }
 
+
+bool ReduceIndexation::reduceIndirection(Loop *L, Expr Subscript,
+                                         LoadInst *&Index, Expr &Scale,
+                                         Expr &Offset) const {
+  Index = nullptr;
+  for (auto &Sym : Subscript.getSymbols()) {
+    Value *V = Sym.getSymbolValue();
+    if (L->isLoopInvariant(V))
+      continue;
+    // Only a single loop-variant atom, the loaded index, is allowed.
+    LoadInst *LI = dyn_cast<LoadInst>(V);
+    if (!LI || (Index && Index != LI)) {
+      RA_DEBUG(dbgs() << "ReduceIndexation: subscript " << Subscript
+                      << " is not a single indirection\n");
+      return false;
+    }
+    Index = LI;
+  }
+
+  if (!Index)
+    return false;
+
+  Expr IndexEx(Index);
+  if (Subscript.degree(IndexEx) != 1) {
+    RA_DEBUG(dbgs() << "ReduceIndexation: subscript " << Subscript
+                    << " is not linear on " << *Index << "\n");
+    return false;
+  }
+
+  Scale  = Subscript.coeff(IndexEx, 1);
+  Offset = Subscript.coeff(IndexEx, 0);
+  if (!LoopInfoExpr::IsLoopInvariant(L, Scale) ||
+      !LoopInfoExpr::IsLoopInvariant(L, Offset)) {
+    RA_DEBUG(dbgs() << "ReduceIndexation: scale " << Scale << " or offset "
+                    << Offset << " varies inside the loop\n");
+    return false;
+  }
+
+  RA_DEBUG(dbgs() << "ReduceIndexation: reduced indirection " << Subscript
+                  << " to " << Scale << " * " << *Index << " + " << Offset
+                  << "\n");
+  return true;
+}
@@ -5,6 +5,7 @@
 #include "LoopInfoExpr.h"
 
 #include "llvm/Pass.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Instructions.h"
 
@@ -22,6 +23,12 @@ public:
                            Expr &Offset) const;
   bool reduceMemoryOp(Value *V, Value *&Array, Expr& Offset)   const;
 
+  // Recognizes indirect subscripts of the form Scale * Index + Offset, where
+  // Index is a load inside L (e.g. A[B[i]]) and Scale & Offset are invariant
+  // in L.
+  bool reduceIndirection(Loop *L, Expr Subscript, LoadInst *&Index,
+                         Expr &Scale, Expr &Offset) const;
+
 private:
   DataLayout *DL_;
   LoopInfoExpr *LIE_;
@@ -3,6 +3,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
 
 /* ************************************************************************** */
 /* ************************************************************************** */
@@ -12,6 +13,25 @@ static cl::opt<bool>
           cl::desc("Enable debugging for the relative execution pass"),
           cl::Hidden, cl::init(false));
 
+static cl::opt<std::string>
+  ClCacheDir("rel-exec-cache-dir",
+             cl::desc("Directory in which closed-form summations are cached "
+                      "across compilations"),
+             cl::Hidden, cl::init(""));
+
+static cl::opt<bool>
+  ClSymPyFallback("rel-exec-sympy-fallback",
+                  cl::desc("Use SymPy for summations that the native engine "
+                           "cannot handle"),
+                  cl::Hidden, cl::init(false));
+
+static cl::opt<bool>
+  ClEstimatedTripCounts("rel-exec-estimated-trip-counts",
+                        cl::desc("Fall back to the trip counts estimated at "
+                                 "runtime by -tc-generator (requires the "
+                                 "DepGraph module)"),
+                        cl::Hidden, cl::init(false));
+
 static RegisterPass<RelativeExecutions>
   X("rel-exec", "Location-relative execution count inference");
 char RelativeExecutions::ID = 0;
@@ -29,7 +49,15 @@ void RelativeExecutions::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<DominatorTree>();
   AU.addRequired<LoopInfo>();
   AU.addRequired<LoopInfoExpr>();
-  AU.addRequired<SymPyInterface>();
+  if (ClSymPyFallback)
+    AU.addRequired<SymPyInterface>();
+  if (ClEstimatedTripCounts) {
+    AnalysisID TCAID = GetTripCountAnalysisID();
+    if (!TCAID)
+      report_fatal_error("-rel-exec-estimated-trip-counts requires "
+                         "DepGraph.so");
+    AU.addRequiredID(TCAID);
+  }
   AU.setPreservesAll();
 }
 
@@ -37,16 +65,71 @@ bool RelativeExecutions::runOnFunction(Function &F) {
   DT_  = &getAnalysis<DominatorTree>();
   LI_  = &getAnalysis<LoopInfo>();
   LIE_ = &getAnalysis<LoopInfoExpr>();
-  SPI_ = &getAnalysis<SymPyInterface>();
+  SPI_ = ClSymPyFallback ? &getAnalysis<SymPyInterface>() : nullptr;
+  TCA_ = ClEstimatedTripCounts ? &getAnalysisID<Pass>(GetTripCountAnalysisID())
+                                : nullptr;
+  Cache_.setDirectory(ClCacheDir);
   return false;
 }
 
+Expr RelativeExecutions::sum(Expr Summand, PHINode *Indvar, Expr Lower,
+                             Expr Upper) {
+  Expr IndvarEx(Indvar);
+  Expr Ret = NativeSummation(Summand, IndvarEx, Lower, Upper);
+  if (Ret.isValid() || !SPI_)
+    return Ret;
+
+  // Only the SymPy path is worth caching; the native one is cheaper than a
+  // lookup.
+  if (Cache_.lookup(Summand, IndvarEx, Lower, Upper, Ret))
+    return Ret;
+
+  Ret = sumWithSymPy(Summand, IndvarEx, Lower, Upper);
+  if (Ret.isValid())
+    Cache_.insert(Summand, IndvarEx, Lower, Upper, Ret);
+  return Ret;
+}
+
+Expr RelativeExecutions::sumWithSymPy(Expr Summand, Expr IndvarEx, Expr Lower,
+                                      Expr Upper) {
+  PyObject *SummandObj = SPI_->conv(Summand);
+  PyObject *IndvarObj  = SPI_->conv(IndvarEx);
+  PyObject *LowerObj   = SPI_->conv(Lower);
+  PyObject *UpperObj   = SPI_->conv(Upper);
+  if (!SummandObj || !IndvarObj || !LowerObj || !UpperObj)
+    return Expr::InvalidExpr();
+
+  PyObject *Summation = SPI_->summation(SummandObj, IndvarObj, LowerObj,
+                                        UpperObj);
+  if (!Summation)
+    return Expr::InvalidExpr();
+  return SPI_->conv(SPI_->expand(Summation));
+}
+
+Expr RelativeExecutions::sumOverLoop(Expr Summand, PHINode *Indvar,
+                                     Expr Start, Expr End, Expr Step,
+                                     bool Geometric) {
+  if (Geometric)
+    return NativeGeometricSummation(Summand, Expr(Indvar), Start, End, Step);
+  return sum(Summand/Step, Indvar, Start, End);
+}
+
 Expr RelativeExecutions::getExecutionsRelativeTo(Loop *L, Loop *Toplevel,
                                                  Loop *&Final) {
+  Expr Ret = getExactExecutionsRelativeTo(L, Toplevel, Final);
+  if (Ret.isValid() || !TCA_)
+    return Ret;
+  return getEstimatedExecutionsRelativeTo(L, Toplevel, Final);
+}
+
+Expr RelativeExecutions::getExactExecutionsRelativeTo(Loop *L, Loop *Toplevel,
+                                                      Loop *&Final) {
   PHINode *Indvar;
   Expr IndvarStart, IndvarEnd, IndvarStep;
+  bool Geometric;
 
-  if (!LIE_->getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep)) {
+  if (!LIE_->getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep,
+                         &Geometric)) {
     RE_DEBUG(dbgs() << "RelativeExecutions: could not get loop info for loop at "
                     << L->getHeader()->getName() << "\n");
     return Expr::InvalidExpr();
@@ -54,72 +137,99 @@ Expr RelativeExecutions::getExecutionsRelativeTo(Loop *L, Loop *Toplevel,
 
   RE_DEBUG(dbgs() << "RelativeExecutions: induction variable, start, end, step: "
                   << *Indvar << " => (" << IndvarStart << ", " << IndvarEnd
-                  << ", +" << IndvarStep << ")\n");
-
-  PyObject *Summation = nullptr;
-
-  {
-    PyObject *IndvarObj       = SPI_->conv(Indvar);
-    PyObject *IndvarStepObj   = SPI_->conv(IndvarStep);
-    PyObject *IndvarStartObj  = SPI_->conv(IndvarStart);
-    PyObject *IndvarEndObj    = SPI_->conv(IndvarEnd);
-    assert(IndvarObj && IndvarStepObj && IndvarStartObj && IndvarEndObj &&
-           "Conversion error");
-
-    PyObject *Summand = SPI_->inverse(IndvarStepObj);
-    Summation = SPI_->summation(Summand, IndvarObj, IndvarStartObj,
-                                IndvarEndObj);
-    RE_DEBUG(dbgs() << "RelativeExecutions: summation for loop at "
-                    << L->getHeader()->getName() << " is: " << *Summation
-                    << "\n");
-  }
+                  << ", " << (Geometric ? "*" : "+") << IndvarStep << ")\n");
+
+  Expr Summation = sumOverLoop(Expr(1L), Indvar, IndvarStart, IndvarEnd,
+                               IndvarStep, Geometric);
+  RE_DEBUG(dbgs() << "RelativeExecutions: summation for loop at "
+                  << L->getHeader()->getName() << " is: " << Summation
+                  << "\n");
+  if (!Summation.isValid())
+    return Expr::InvalidExpr();
 
   while ((Final = L) && (L = L->getParentLoop())) {
-    if (!LIE_->getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep)) {
+    if (!LIE_->getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep,
+                           &Geometric)) {
       RE_DEBUG(dbgs() << "RelativeExecutions: could not get loop info for loop "
                          "at " << L->getHeader()->getName() << "\n");
-      Expr Ret = SPI_->conv(Summation);
       RE_DEBUG(dbgs() << "RelativeExecutions: partial success; returning "
-                      << Ret << "\n");
-      return Ret;
+                      << Summation << "\n");
+      return Summation;
     }
 
     RE_DEBUG(dbgs() << "RelativeExecutions: induction variable, start, end, "
                        "step: " << *Indvar << " => (" << IndvarStart << ", "
-                     << IndvarEnd << ", +" << IndvarStep << ")\n");
-
-    Expr SummationEx = SPI_->conv(Summation);
-    Summation = SPI_->conv(SummationEx);
-
-    PyObject *IndvarObj       = SPI_->conv(Indvar);
-    PyObject *IndvarStepObj   = SPI_->conv(IndvarStep);
-    PyObject *IndvarStartObj  = SPI_->conv(IndvarStart);
-    PyObject *IndvarEndObj    = SPI_->conv(IndvarEnd);
-    assert(IndvarObj && IndvarStepObj && IndvarStartObj && IndvarEndObj &&
-           "Conversion error");
-
-    PyObject *Summand = SPI_->mul(Summation, SPI_->inverse(IndvarStepObj));
-    Summation = SPI_->summation(Summand, IndvarObj, IndvarStartObj,
-                                IndvarEndObj);
-    Summation = SPI_->expand(Summation);
+                     << IndvarEnd << ", " << (Geometric ? "*" : "+")
+                     << IndvarStep << ")\n");
+
+    Summation = sumOverLoop(Summation, Indvar, IndvarStart, IndvarEnd,
+                            IndvarStep, Geometric);
     RE_DEBUG(dbgs() << "RelativeExecutions: summation for loop at "
-                    << L->getHeader()->getName() << " is: " << *Summation
+                    << L->getHeader()->getName() << " is: " << Summation
                     << "\n");
+    if (!Summation.isValid())
+      return Expr::InvalidExpr();
 
     if (L == Toplevel)
       break;
   }
 
   if (L == Toplevel || !Toplevel) {
-    Expr Ret = SPI_->conv(Summation);
-    RE_DEBUG(dbgs() << "RelativeExecutions: success; returning " << Ret << "\n");
-    return Ret;
+    RE_DEBUG(dbgs() << "RelativeExecutions: success; returning " << Summation
+                    << "\n");
+    return Summation;
   } else {
-    // Expr Ret = SPI_->conv(Summation);
     RE_DEBUG(dbgs() << "RelativeExecutions: toplevel loop has not been "
                        "reached\n");
-    // return Ret;
     return Expr::InvalidExpr();
   }
 }
 
+
+Expr RelativeExecutions::getEstimatedExecutionsRelativeTo(Loop *L,
+                                                          Loop *Toplevel,
+                                                          Loop *&Final) {
+  // Trip counts are computed in the entry block the generator adds before
+  // each loop, so those of inner loops may depend on outer induction
+  // variables; the nest is only extended while all of them can be hoisted.
+  std::vector<Instruction*> Trips;
+  Final = nullptr;
+  for (; L; L = L->getParentLoop()) {
+    Instruction *Trip = GetTripCount(TCA_, L->getHeader());
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Trip || !Preheader) {
+      RE_DEBUG(dbgs() << "RelativeExecutions: no estimated trip count for "
+                         "loop at " << L->getHeader()->getName() << "\n");
+      break;
+    }
+
+    Trips.push_back(Trip);
+    bool Available = true;
+    for (auto T : Trips)
+      Available &= DT_->dominates(T, Preheader->getTerminator());
+    if (!Available) {
+      Trips.pop_back();
+      RE_DEBUG(dbgs() << "RelativeExecutions: estimated trip counts are not "
+                         "available at the preheader of loop at "
+                      << L->getHeader()->getName() << "\n");
+      break;
+    }
+
+    Final = L;
+    if (L == Toplevel)
+      break;
+  }
+
+  if (!Final || (Toplevel && Final != Toplevel)) {
+    RE_DEBUG(dbgs() << "RelativeExecutions: could not estimate executions\n");
+    return Expr::InvalidExpr();
+  }
+
+  Expr Executions(1L);
+  for (auto T : Trips)
+    Executions = Executions * Expr(T);
+  RE_DEBUG(dbgs() << "RelativeExecutions: estimated executions relative to "
+                  << Final->getHeader()->getName() << ": " << Executions
+                  << "\n");
+  return Executions;
+}
@@ -1,8 +1,11 @@
 #ifndef _RELATIVEEXECUTIONS_H_
 #define _RELATIVEEXECUTIONS_H_
 
+#include "DepGraphBridge.h"
 #include "LoopInfoExpr.h"
+#include "NativeSummation.h"
 #include "PythonInterface.h"
+#include "SummationCache.h"
 
 #include "llvm/Pass.h"
 #include "llvm/Analysis/Dominators.h"
@@ -18,14 +21,32 @@ public:
 
   // Returns the number of times a basic block whose immediate dominator is
   // L's loop header executes relative to Toplevel. Final will indicate the
-  // outer-most loop that was reached.
+  // outer-most loop that was reached. If no closed form is found and
+  // -rel-exec-estimated-trip-counts is given, the result is built from the
+  // trip counts estimated at runtime by DepGraph's TripCountGenerator.
   Expr getExecutionsRelativeTo(Loop *L, Loop *Toplevel, Loop *&Final);
 
 private:
+  Expr getExactExecutionsRelativeTo(Loop *L, Loop *Toplevel, Loop *&Final);
+  // Product of the estimated trip counts from L outwards, up to the outermost
+  // loop in whose preheader all of them are available.
+  Expr getEstimatedExecutionsRelativeTo(Loop *L, Loop *Toplevel,
+                                        Loop *&Final);
+
+  // Closed form of the sum of Summand for Indvar in [Lower, Upper].
+  Expr sum(Expr Summand, PHINode *Indvar, Expr Lower, Expr Upper);
+  Expr sumWithSymPy(Expr Summand, Expr Indvar, Expr Lower, Expr Upper);
+  // Sum of Summand over all iterations of a loop, given its induction
+  // variable's start, end & additive or geometric step.
+  Expr sumOverLoop(Expr Summand, PHINode *Indvar, Expr Start, Expr End,
+                   Expr Step, bool Geometric);
+
   DominatorTree  *DT_;
   LoopInfo       *LI_;
   LoopInfoExpr   *LIE_;
   SymPyInterface *SPI_;
+  Pass           *TCA_;
+  SummationCache  Cache_;
 };
 
 #endif
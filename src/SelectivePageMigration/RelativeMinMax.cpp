@@ -1,8 +1,13 @@
 #include "RelativeMinMax.h"
+#include "SymbolicBounds.h"
 
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/IR/ValueSymbolTable.h"
+
+#include <cctype>
 
 /* ************************************************************************** */
 /* ************************************************************************** */
@@ -12,6 +17,12 @@ static cl::opt<bool>
           cl::desc("Enable debugging for the relative min/max pass"),
           cl::Hidden, cl::init(false));
 
+static cl::opt<bool>
+  ClSymbolicRA("rel-minmax-symbolic-ra",
+               cl::desc("Bound loop-variant values that are not induction "
+                        "variables with SymbolicRA's range analysis"),
+               cl::Hidden, cl::init(false));
+
 static RegisterPass<RelativeMinMax>
   X("rel-minmax", "Location-relative inference of max and mins");
 char RelativeMinMax::ID = 0;
@@ -21,20 +32,104 @@ char RelativeMinMax::ID = 0;
 /* ************************************************************************** */
 /* ************************************************************************** */
 
+static bool HasOnlyMinMax(Expr Ex) {
+  if (Ex.isConstant() || Ex.isSymbol())
+    return true;
+  if (!Ex.isAdd() && !Ex.isMul() && !Ex.isPow() && !Ex.isMin() && !Ex.isMax())
+    return false;
+  for (auto SubEx : Ex)
+    if (!HasOnlyMinMax(SubEx))
+      return false;
+  return true;
+}
+
 void RelativeMinMax::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<DominatorTree>();
+  AU.addRequired<LoopInfo>();
   AU.addRequired<LoopInfoExpr>();
-  AU.addRequired<SymPyInterface>();
+  if (ClSymbolicRA) {
+    AnalysisID SRAID = GetSymbolicRangeAnalysisID();
+    if (!SRAID)
+      report_fatal_error("-rel-minmax-symbolic-ra requires SymbolicRA.so");
+    AU.addRequiredID(SRAID);
+  }
   AU.setPreservesAll();
 }
 
 bool RelativeMinMax::runOnFunction(Function &F) {
+  F_   = &F;
   DT_  = &getAnalysis<DominatorTree>();
+  LI_  = &getAnalysis<LoopInfo>();
   LIE_ = &getAnalysis<LoopInfoExpr>();
-  SPI_ = &getAnalysis<SymPyInterface>();
+  SRA_ = ClSymbolicRA ? &getAnalysisID<Pass>(GetSymbolicRangeAnalysisID())
+                      : nullptr;
   return false;
 }
 
+Expr RelativeMinMax::parseBound(string Str) {
+  // SymbolicRA names symbols after their values, but LLVM names may contain
+  // characters GiNaC's parser rejects, so rename them before parsing.
+  map<string, Expr> Symbols;
+  string Renamed;
+  size_t Idx = 0;
+  while (Idx < Str.size()) {
+    if (!isalpha(Str[Idx]) && Str[Idx] != '_') {
+      Renamed += Str[Idx++];
+      continue;
+    }
+
+    size_t End = Idx;
+    while (End < Str.size() &&
+           (isalnum(Str[End]) || Str[End] == '_' || Str[End] == '.'))
+      ++End;
+    string Token = Str.substr(Idx, End - Idx);
+    Idx = End;
+
+    // Function names, such as min & max, are kept as they are.
+    if (Idx < Str.size() && Str[Idx] == '(') {
+      Renamed += Token;
+      continue;
+    }
+
+    Value *V = F_->getValueSymbolTable().lookup(Token);
+    if (!V) {
+      RMM_DEBUG(dbgs() << "RelativeMinMax: unknown value in bound: " << Token
+                       << "\n");
+      return Expr::InvalidExpr();
+    }
+    string Name = "s" + std::to_string(Symbols.size());
+    Symbols[Name] = Expr(V);
+    Renamed += Name;
+  }
+  return Expr::Parse(Renamed, Symbols);
+}
+
+bool RelativeMinMax::getSymbolicMinMax(Value *V, Expr &Min, Expr &Max) {
+  if (Visiting_.count(V))
+    return false;
+
+  string Lower, Upper;
+  if (!GetSymbolicBounds(SRA_, V, Lower, Upper))
+    return false;
+
+  Expr LowerEx = parseBound(Lower), UpperEx = parseBound(Upper);
+  if (!LowerEx.isValid() || !UpperEx.isValid() ||
+      !HasOnlyMinMax(LowerEx) || !HasOnlyMinMax(UpperEx))
+    return false;
+
+  // The bounds may themselves refer to induction variables.
+  Visiting_.insert(V);
+  Expr LowerMin, UpperMax;
+  bool Ret = getMinOf(LowerEx, LowerMin) && getMaxOf(UpperEx, UpperMax);
+  Visiting_.erase(V);
+
+  if (Ret) {
+    Min = LowerMin;
+    Max = UpperMax;
+  }
+  return Ret;
+}
+
 bool RelativeMinMax::addMinMax(Expr PrevMin, Expr PrevMax, Expr OtherMin,
                                Expr OtherMax, Expr &Min, Expr &Max) {
   Min = PrevMin + OtherMin;
@@ -67,7 +162,131 @@ bool RelativeMinMax::mulMinMax(Expr PrevMin, Expr PrevMax, Expr OtherMin,
   }
 }
 
+// Replaces Var in Ex with the bound that minimizes or maximizes Ex, provided
+// Ex is affine in Var with a constant coefficient.
+static bool EliminateAffine(Expr &Ex, Expr Var, Expr Lower, Expr Upper,
+                            bool TakeMax) {
+  int Degree = Ex.degree(Var);
+  if (Degree == 0)
+    return true;
+  if (Degree != 1)
+    return false;
+
+  Expr Coeff = Ex.coeff(Var, 1);
+  if (!Coeff.isConstant())
+    return false;
+
+  Ex = Ex.subs(Var, Coeff.isPositive() == TakeMax ? Upper : Lower);
+  return true;
+}
+
+bool RelativeMinMax::getIndvarBounds(Loop *L, Expr &Lower, Expr &Upper) {
+  PHINode *Indvar;
+  Expr IndvarStart, IndvarEnd, IndvarStep;
+  bool Geometric;
+  if (!LIE_->getLoopInfo(L, Indvar, IndvarStart, IndvarEnd, IndvarStep,
+                         &Geometric))
+    return false;
+
+  BranchInst *BI = cast<BranchInst>(L->getExitingBlock()->getTerminator());
+  switch (cast<ICmpInst>(BI->getCondition())->getPredicate()) {
+    case CmpInst::ICMP_SLT:
+    case CmpInst::ICMP_ULT:
+    case CmpInst::ICMP_SLE:
+    case CmpInst::ICMP_ULE:
+      Lower = IndvarStart;
+      Upper = IndvarEnd;
+      return true;
+    case CmpInst::ICMP_SGT:
+    case CmpInst::ICMP_UGT:
+    case CmpInst::ICMP_UGE:
+    case CmpInst::ICMP_SGE:
+      Lower = IndvarEnd;
+      Upper = IndvarStart;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool RelativeMinMax::getNestMinMax(Expr Ex, Expr &Min, Expr &Max,
+                                   Loop *Within) {
+  Expr MinEx = Ex, MaxEx = Ex;
+  std::set<PHINode*> Eliminated;
+
+  while (true) {
+    // Bounds of a loop are invariant in it, so eliminating the induction
+    // variable of the deepest loop left only brings in outer ones.
+    PHINode *Indvar = nullptr;
+    Loop *IndvarLoop = nullptr;
+    vector<Expr> Symbols = MinEx.getSymbols(), MaxSymbols = MaxEx.getSymbols();
+    Symbols.insert(Symbols.end(), MaxSymbols.begin(), MaxSymbols.end());
+    for (auto& Sym : Symbols) {
+      PHINode *Phi = dyn_cast_or_null<PHINode>(Sym.getSymbolValue());
+      Loop *L = Phi ? LIE_->getLoopForInductionVariable(Phi) : nullptr;
+      if (!L || (Within && (L == Within || !Within->contains(L))))
+        continue;
+      if (!IndvarLoop || L->getLoopDepth() > IndvarLoop->getLoopDepth()) {
+        Indvar     = Phi;
+        IndvarLoop = L;
+      }
+    }
+    if (!Indvar)
+      break;
+    if (!Eliminated.insert(Indvar).second)
+      return false;
+
+    Expr Lower, Upper, IndvarEx(Indvar);
+    if (!getIndvarBounds(IndvarLoop, Lower, Upper) ||
+        !EliminateAffine(MinEx, IndvarEx, Lower, Upper, false) ||
+        !EliminateAffine(MaxEx, IndvarEx, Lower, Upper, true)) {
+      RMM_DEBUG(dbgs() << "RelativeMinMax: could not eliminate " << *Indvar
+                       << " from " << Ex << "\n");
+      return false;
+    }
+  }
+
+  if (Within) {
+    Min = MinEx;
+    Max = MaxEx;
+    return true;
+  }
+
+  if (Eliminated.empty())
+    return false;
+
+  // Whatever is left is bounded as usual.
+  Expr NestMin, NestMax;
+  if (!getMinOf(MinEx, NestMin) || !getMaxOf(MaxEx, NestMax))
+    return false;
+
+  Min = NestMin;
+  Max = NestMax;
+  RMM_DEBUG(dbgs() << "RelativeMinMax: nest min/max for " << Ex << ": " << Min
+                   << ", " << Max << "\n");
+  return true;
+}
+
+bool RelativeMinMax::getMinOf(Expr Ex, Expr &Min) {
+  Expr ExMin, ExMax;
+  if (!getMinMax(Ex, ExMin, ExMax))
+    return false;
+  Min = ExMin;
+  return true;
+}
+
+bool RelativeMinMax::getMaxOf(Expr Ex, Expr &Max) {
+  Expr ExMin, ExMax;
+  if (!getMinMax(Ex, ExMin, ExMax))
+    return false;
+  Max = ExMax;
+  return true;
+}
+
 bool RelativeMinMax::getMinMax(Expr Ex, Expr &Min, Expr &Max) {
+  if (!Ex.isConstant() && !Ex.isSymbol() && getNestMinMax(Ex, Min, Max))
+    return true;
+
   if (Ex.isConstant()) {
     Min = Ex;
     Max = Ex;
@@ -76,7 +295,9 @@ bool RelativeMinMax::getMinMax(Expr Ex, Expr &Min, Expr &Max) {
     if (PHINode *Phi = dyn_cast<PHINode>(Ex.getSymbolValue())) {
       if (Loop *L = LIE_->getLoopForInductionVariable(Phi)) {
         Expr IndvarStart, IndvarEnd, IndvarStep;
-        LIE_->getLoopInfo(L, Phi, IndvarStart, IndvarEnd, IndvarStep);
+        bool Geometric;
+        LIE_->getLoopInfo(L, Phi, IndvarStart, IndvarEnd, IndvarStep,
+                          &Geometric);
 
         BranchInst *BI = cast<BranchInst>(L->getExitingBlock()->getTerminator());
         ICmpInst *ICI = cast<ICmpInst>(BI->getCondition());
@@ -114,6 +335,15 @@ bool RelativeMinMax::getMinMax(Expr Ex, Expr &Min, Expr &Max) {
         return true;
       }
     }
+    // Other values that vary inside a loop are bounded by the range analysis,
+    // if it's available.
+    Instruction *I = dyn_cast_or_null<Instruction>(Ex.getSymbolValue());
+    if (SRA_ && I && LI_->getLoopFor(I->getParent()) &&
+        getSymbolicMinMax(I, Min, Max)) {
+      RMM_DEBUG(dbgs() << "RelativeMinMax: symbolic min/max for " << *I
+                       << ": " << Min << ", " << Max << "\n");
+      return true;
+    }
     Min = Ex;
     Max = Ex;
   } else if (Ex.isAdd()) {
@@ -160,16 +390,23 @@ bool RelativeMinMax::getMinMax(Expr Ex, Expr &Min, Expr &Max) {
       Min = BaseMax ^ Ex.getPowExp();
       Max = BaseMin ^ Ex.getPowExp();
     }
-  } else if (Ex.isMin()) {
-    Expr MinFirst, MinSecond, Bogus;
-    getMinMax(Ex.at(0), MinFirst,  Bogus);
-    getMinMax(Ex.at(1), MinSecond, Bogus);
-    Min = Max = MinFirst.min(MinSecond);
-  } else if (Ex.isMax()) {
-    Expr MaxFirst, MaxSecond, Bogus;
-    getMinMax(Ex.at(0), MaxFirst,  Bogus);
-    getMinMax(Ex.at(1), MaxSecond, Bogus);
-    Min = Max = MaxFirst.max(MaxSecond);
+  } else if (Ex.isMin() || Ex.isMax()) {
+    Expr MinFirst, MaxFirst, MinSecond, MaxSecond;
+    if (!getMinMax(Ex.at(0), MinFirst, MaxFirst) ||
+        !getMinMax(Ex.at(1), MinSecond, MaxSecond)) {
+      RMM_DEBUG(dbgs() << "RelativeMinMax: Could not infer min/max for "
+                       << Ex.at(0) << " and/or " << Ex.at(1) << "\n");
+      return false;
+    }
+    // Both min and max are monotonic in each operand, so the bounds of the
+    // result are the min (max) of the operands' lower and upper bounds.
+    if (Ex.isMin()) {
+      Min = MinFirst.min(MinSecond);
+      Max = MaxFirst.min(MaxSecond);
+    } else {
+      Min = MinFirst.max(MinSecond);
+      Max = MaxFirst.max(MaxSecond);
+    }
   } else {
     RMM_DEBUG(dbgs() << "RelativeMinMax: unhandled expression: " << Ex << "\n");
     return false;
@@ -177,6 +414,11 @@ bool RelativeMinMax::getMinMax(Expr Ex, Expr &Min, Expr &Max) {
   return true;
 }
 
+bool RelativeMinMax::getMinMaxWithin(Loop *Outer, Expr Ex, Expr &Min,
+                                     Expr &Max) {
+  return getNestMinMax(Ex, Min, Max, Outer);
+}
+
 bool RelativeMinMax::getMinMaxRelativeTo(Loop *L, Value *V,
                                          Expr &Min, Expr &Max) {
   Expr Ex = LIE_->getExprForLoop(L, V);
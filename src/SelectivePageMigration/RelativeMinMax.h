@@ -13,6 +13,7 @@
 //#include "llvm/Support/Debug.h"
 
 #include <python2.7/Python.h>
+#include <set>
 #include <vector>
 
 class RelativeMinMax : public FunctionPass {
@@ -25,6 +26,9 @@ public:
 
   bool getMinMaxRelativeTo(Loop *L, Value *V, Expr &Min, Expr &Max);
   bool getMinMax(Expr Ex, Expr &Min, Expr &Max);
+  // Min/max of Ex over a single iteration of Outer: only the induction
+  // variables of loops nested in Outer vary, the others are kept as symbols.
+  bool getMinMaxWithin(Loop *Outer, Expr Ex, Expr &Min, Expr &Max);
 
 private:
   bool addMinMax(Expr PrevMin, Expr PrevMax, Expr OtherMin, Expr OtherMax,
@@ -32,10 +36,32 @@ private:
   bool mulMinMax(Expr PrevMin, Expr PrevMax, Expr OtherMin, Expr OtherMax,
                  Expr &Min, Expr &Max);
 
+  // getMinMax accumulates sums into Min & Max, so it must start from zeroed
+  // outputs. These run it on fresh ones and only write the bound they are
+  // after, and only on success.
+  bool getMinOf(Expr Ex, Expr &Min);
+  bool getMaxOf(Expr Ex, Expr &Max);
+
+  // Min/max of an affine expression, found by replacing induction variables
+  // with their bounds from the innermost loop outwards. Inner bounds may thus
+  // depend on outer induction variables, as in triangular nests. If Within is
+  // given, only loops nested in it are eliminated.
+  bool getNestMinMax(Expr Ex, Expr &Min, Expr &Max, Loop *Within = nullptr);
+  bool getIndvarBounds(Loop *L, Expr &Lower, Expr &Upper);
+
+  // Min/max of V taken from the bounds SymbolicRangeAnalysis gives for it.
+  bool getSymbolicMinMax(Value *V, Expr &Min, Expr &Max);
+  Expr parseBound(string Str);
+
+  Function *F_;
   LoopInfo *LI_;
   DominatorTree *DT_;
-  SymPyInterface *SPI_;
   LoopInfoExpr *LIE_;
+  Pass *SRA_;
+
+  // Values whose symbolic bounds are being expanded, to stop the recursion on
+  // mutually-dependent bounds.
+  std::set<Value*> Visiting_;
 };
 
 #endif
@@ -0,0 +1,80 @@
+#include "ReuseDistance.h"
+
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+static cl::opt<bool>
+  ClDebug("reuse-distance-debug",
+          cl::desc("Enable debugging for the reuse distance analysis"),
+          cl::Hidden, cl::init(false));
+
+static RegisterPass<ReuseDistance>
+  X("reuse-distance", "Per-array reuse distance estimation");
+char ReuseDistance::ID = 0;
+
+#define RD_DEBUG(X) { if (ClDebug) { X; } }
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+void ReuseDistance::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<LoopInfoExpr>();
+  AU.addRequired<RelativeMinMax>();
+  AU.setPreservesAll();
+}
+
+bool ReuseDistance::runOnFunction(Function &F) {
+  LIE_ = &getAnalysis<LoopInfoExpr>();
+  RMM_ = &getAnalysis<RelativeMinMax>();
+  return false;
+}
+
+Expr ReuseDistance::getReuseDistance(Loop *L, Loop *Final, Expr Subscript,
+                                     unsigned Size) {
+  // Find the carrier: every iteration of it touches the same elements, so the
+  // bytes touched in between are those of a single iteration.
+  Loop *Carrier = nullptr;
+  for (Loop *Cur = L; Cur; Cur = Cur->getParentLoop()) {
+    PHINode *Indvar;
+    Expr Start, End, Step;
+    bool Geometric;
+    if (!LIE_->getLoopInfo(Cur, Indvar, Start, End, Step, &Geometric)) {
+      RD_DEBUG(dbgs() << "ReuseDistance: no induction variable for loop "
+                      << Cur->getHeader()->getName() << "\n");
+      return Expr::InvalidExpr();
+    }
+    if (!Subscript.has(Expr(Indvar))) {
+      Carrier = Cur;
+      break;
+    }
+    if (Cur == Final)
+      break;
+  }
+
+  if (!Carrier) {
+    RD_DEBUG(dbgs() << "ReuseDistance: no loop carries reuse for "
+                    << Subscript << "\n");
+    return Expr::InvalidExpr();
+  }
+
+  Expr Min, Max;
+  if (!RMM_->getMinMaxWithin(Carrier, Subscript, Min, Max))
+    return Expr::InvalidExpr();
+
+  Expr Distance = Max - Min + Size;
+  if (!LoopInfoExpr::IsLoopInvariant(Final, Distance)) {
+    RD_DEBUG(dbgs() << "ReuseDistance: distance " << Distance
+                    << " varies inside loop " << Final->getHeader()->getName()
+                    << "\n");
+    return Expr::InvalidExpr();
+  }
+
+  RD_DEBUG(dbgs() << "ReuseDistance: distance for " << Subscript
+                  << " carried by " << Carrier->getHeader()->getName() << ": "
+                  << Distance << "\n");
+  return Distance;
+}
@@ -0,0 +1,32 @@
+#ifndef _REUSEDISTANCE_H_
+#define _REUSEDISTANCE_H_
+
+#include "LoopInfoExpr.h"
+#include "RelativeMinMax.h"
+
+#include "llvm/Pass.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+class ReuseDistance : public FunctionPass {
+public:
+  static char ID;
+  ReuseDistance() : FunctionPass(ID) { }
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+  virtual bool runOnFunction(Function &F);
+
+  // Estimates, in bytes, the distance between consecutive uses of the element
+  // at Subscript by an access of Size bytes in loop L, for a nest hoisted to
+  // Final. The reuse is carried by the innermost loop from L outwards whose
+  // induction variable does not appear in Subscript, and the distance is the
+  // span of Subscript over one iteration of that loop. Only the bytes of the
+  // accessed array are counted. Returns InvalidExpr if there is no such loop
+  // or the span varies inside Final.
+  Expr getReuseDistance(Loop *L, Loop *Final, Expr Subscript, unsigned Size);
+
+private:
+  LoopInfoExpr   *LIE_;
+  RelativeMinMax *RMM_;
+};
+
+#endif
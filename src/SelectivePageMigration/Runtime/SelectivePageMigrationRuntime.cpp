@@ -1,10 +1,14 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdarg>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <hwloc.h>
 
 
@@ -17,18 +21,26 @@
 extern "C" {
   void __spm_init();
   void __spm_end();
-  void __spm_get (void *Array, long Start, long End, long Reuse);
-  //void __spm_give(void *Array, long Start, long End, long Reuse);
+  void __spm_get (void *Array, long Start, long End, long Reuse,
+                  long Distance);
+  void __spm_get_merged(long N, ...);
+  void __spm_inspect(void *Array, void *Index, long Start, long End,
+                     long Size, long Scale, long Offset, long Reuse);
+  //void __spm_give(void *Array, long Start, long End, long Reuse,
+  //                long Distance);
 }
 
 const double __spm_ReuseConstant = 200.0;
 const double __spm_CacheConstant = 0.1;
+const size_t __spm_InspectorCacheSize = 1024;
 
 const long PAGE_EXP  = 12;
 const long PAGE_SIZE = (1 << PAGE_EXP);
 
 hwloc_topology_t __spm_topo;
 unsigned long __spm_cache_size = 0;
+// Size of the last-level cache of the first PU.
+unsigned long __spm_llc_size = 0;
 
 class PageIntervals {
 private:
@@ -181,8 +193,10 @@ void __spm_init() {
   hwloc_obj_t obj;
   for (obj = hwloc_get_obj_by_type(__spm_topo, HWLOC_OBJ_PU, 0); obj;
        obj = obj->parent)
-    if (obj->type == HWLOC_OBJ_CACHE)
+    if (obj->type == HWLOC_OBJ_CACHE) {
       __spm_cache_size += obj->attr->cache.size;
+      __spm_llc_size = obj->attr->cache.size;
+    }
 
 }
 
@@ -192,10 +206,17 @@ void __spm_end() {
 }
 
 
-void __spm_get(void *Ary, long Start, long End, long Reuse) {
+void __spm_get(void *Ary, long Start, long End, long Reuse, long Distance) {
 	SPMR_DEBUG(std::cout << "Runtime: get page for: " << (long unsigned)Ary
 		<< ", " << Start << ", " << End << ", "
-		<< Reuse << "\n");
+		<< Reuse << ", " << Distance << "\n");
+
+	// Data reused within the LLC is served from the cache, wherever its pages
+	// live. A negative distance is unknown.
+	if (Distance >= 0 && (unsigned long)Distance <= __spm_llc_size) {
+		SPMR_DEBUG(std::cout << "Runtime: reuse distance fits in LLC\n");
+		return;
+	}
 
 	long PageStart = ((long)Ary + Start)/PAGE_SIZE;
 	long PageEnd   = ((long)Ary + End)/PAGE_SIZE;
@@ -227,6 +248,152 @@ void __spm_get(void *Ary, long Start, long End, long Reuse) {
 	}//heuristic
 }
 
+// Arguments are N groups of (void *Array, long Start, long End, long Reuse,
+// long Distance) for arrays that may alias. Overlapping ranges are merged
+// transitively and each resulting range is handed to __spm_get once.
+void __spm_get_merged(long N, ...) {
+  struct Range {
+    long Start, End, Reuse, Distance;
+    bool operator<(const Range &Other) const { return Start < Other.Start; }
+  };
+
+  std::vector<Range> Ranges(N);
+  va_list Args;
+  va_start(Args, N);
+  for (long I = 0; I < N; ++I) {
+    long Base = (long)va_arg(Args, void*);
+    Ranges[I].Start    = Base + va_arg(Args, long);
+    Ranges[I].End      = Base + va_arg(Args, long);
+    Ranges[I].Reuse    = va_arg(Args, long);
+    Ranges[I].Distance = va_arg(Args, long);
+  }
+  va_end(Args);
+
+  std::sort(Ranges.begin(), Ranges.end());
+  for (size_t I = 0, J; I < Ranges.size(); I = J) {
+    Range Merged = Ranges[I];
+    for (J = I + 1; J < Ranges.size() && Ranges[J].Start <= Merged.End; ++J) {
+      SPMR_DEBUG(std::cout << "Runtime: merging (" << Ranges[J].Start << ", "
+                           << Ranges[J].End << ") into (" << Merged.Start
+                           << ", " << Merged.End << ")\n");
+      Merged.End    = std::max(Merged.End, Ranges[J].End);
+      Merged.Reuse += Ranges[J].Reuse;
+      // Distances of -1 are unknown and stay so when merged.
+      if (Merged.Distance < 0 || Ranges[J].Distance < 0)
+        Merged.Distance = -1;
+      else
+        Merged.Distance = std::max(Merged.Distance, Ranges[J].Distance);
+    }
+    __spm_get(nullptr, Merged.Start, Merged.End, Merged.Reuse,
+              Merged.Distance);
+  }
+}
+
+struct InspectorKey {
+  void *Ary, *Idx;
+  long Start, End, Size, Scale, Offset;
+
+  bool operator==(const InspectorKey &Other) const {
+    return Ary == Other.Ary && Idx == Other.Idx && Start == Other.Start &&
+           End == Other.End && Size == Other.Size && Scale == Other.Scale &&
+           Offset == Other.Offset;
+  }
+};
+
+struct InspectorKeyHasher {
+  size_t operator()(const InspectorKey &Key) const {
+    return (size_t)((long)Key.Ary + (long)Key.Idx + Key.Start + Key.End);
+  }
+};
+
+// Checksum of the index array of every inspected range. A range whose index
+// array checksum did not change since it was last inspected is skipped.
+static thread_local std::unordered_map<InspectorKey, long, InspectorKeyHasher>
+  __spm_inspected;
+
+// Finalizer of SplitMix64: every input bit affects every output bit.
+static inline uint64_t mix(uint64_t X) {
+  X = (X ^ (X >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  X = (X ^ (X >> 27)) * 0x94d049bb133111ebULL;
+  return X ^ (X >> 31);
+}
+
+// Any permutation of the indices touches the same pages, so the checksum is
+// order-insensitive: a sum of well-mixed hashes of each index, which, unlike
+// plain sums or xors of the indices, does not collide for simple changes such
+// as {1, 2} -> {0, 3}. The loop is still easily vectorized.
+template<class T>
+static long checksum(const T *Idx, long N) {
+  uint64_t Sum = mix(N);
+  for (long I = 0; I < N; ++I)
+    Sum += mix((uint64_t)(int64_t)Idx[I]);
+  return (long)Sum;
+}
+
+template<class T>
+static void collectPages(const T *Idx, long N, long Base, long Scale,
+                         std::vector<long> &Pages) {
+  Pages.resize(N);
+  for (long I = 0; I < N; ++I)
+    Pages[I] = (Base + Scale * (long)Idx[I]) >> PAGE_EXP;
+  std::sort(Pages.begin(), Pages.end());
+  Pages.erase(std::unique(Pages.begin(), Pages.end()), Pages.end());
+}
+
+void __spm_inspect(void *Ary, void *Idx, long Start, long End, long Size,
+                   long Scale, long Offset, long Reuse) {
+  SPMR_DEBUG(std::cout << "Runtime: inspect pages for: " << (long unsigned)Ary
+                       << " through " << (long unsigned)Idx << ", " << Start
+                       << ", " << End << ", " << Reuse << "\n");
+
+  if (End < Start)
+    return;
+
+  long N = (End - Start)/Size + 1;
+  const char *First = (const char*)Idx + Start;
+  long Checksum;
+  switch (Size) {
+    case 1: Checksum = checksum((const int8_t*)First,  N); break;
+    case 2: Checksum = checksum((const int16_t*)First, N); break;
+    case 4: Checksum = checksum((const int32_t*)First, N); break;
+    case 8: Checksum = checksum((const int64_t*)First, N); break;
+    default:
+      return;
+  }
+
+  InspectorKey Key = { Ary, Idx, Start, End, Size, Scale, Offset };
+  auto It = __spm_inspected.find(Key);
+  if (It != __spm_inspected.end() && It->second == Checksum) {
+    SPMR_DEBUG(std::cout << "Runtime: index array unchanged since last "
+                            "inspection\n");
+    return;
+  }
+  if (__spm_inspected.size() >= __spm_InspectorCacheSize)
+    __spm_inspected.clear();
+  __spm_inspected[Key] = Checksum;
+
+  std::vector<long> Pages;
+  long Base = (long)Ary + Offset;
+  switch (Size) {
+    case 1: collectPages((const int8_t*)First,  N, Base, Scale, Pages); break;
+    case 2: collectPages((const int16_t*)First, N, Base, Scale, Pages); break;
+    case 4: collectPages((const int32_t*)First, N, Base, Scale, Pages); break;
+    case 8: collectPages((const int64_t*)First, N, Base, Scale, Pages); break;
+  }
+
+  long Footprint = Pages.size() * PAGE_SIZE;
+  if ((double)Footprint > __spm_CacheConstant*__spm_cache_size &&
+      (double)Reuse/Footprint > __spm_ReuseConstant) {
+    // Migrate each run of consecutive pages with a single call.
+    for (size_t Run = 0, Next; Run < Pages.size(); Run = Next) {
+      for (Next = Run + 1;
+           Next < Pages.size() && Pages[Next] == Pages[Next - 1] + 1; ++Next)
+        ;
+      migrate(Pages[Run], Pages[Next - 1] + 1);
+    }
+  }
+}
+
 //void __spm_give(void *Array, long Start, long End, long Reuse) {
   // Currently unused.
 //}
@@ -1,12 +1,17 @@
 #include "SelectivePageMigration.h"
 
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
 
+#include <map>
+#include <set>
 #include <vector>
 
 using namespace llvm;
@@ -25,6 +30,18 @@ static cl::opt<std::string>
          cl::desc("Only analyze/transform the given function"),
          cl::Hidden, cl::init(""));
 
+static cl::opt<bool>
+  ClInspector("spm-inspector",
+              cl::desc("Migrate the pages touched by indirect accesses "
+                       "(A[B[i]]) by inspecting the index array at runtime"),
+              cl::Hidden, cl::init(false));
+
+static cl::opt<bool>
+  ClAliasSets("spm-alias-sets",
+              cl::desc("Merge the migrated ranges of arrays that share an "
+                       "alias set (requires the DepGraph module)"),
+              cl::Hidden, cl::init(false));
+
 static RegisterPass<SelectivePageMigration>
   X("spm", "ccNUMA selective page migration transformation");
 char SelectivePageMigration::ID = 0;
@@ -41,7 +58,13 @@ void SelectivePageMigration::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<ReduceIndexation>();
   AU.addRequired<RelativeExecutions>();
   AU.addRequired<RelativeMinMax>();
-  AU.addRequired<SymPyInterface>();
+  AU.addRequired<ReuseDistance>();
+  if (ClAliasSets) {
+    AnalysisID ASID = GetAliasSetsID();
+    if (!ASID)
+      report_fatal_error("-spm-alias-sets requires DepGraph.so");
+    AU.addRequiredID(ASID);
+  }
   AU.setPreservesAll();
 }
 
@@ -52,6 +75,8 @@ bool SelectivePageMigration::runOnFunction(Function &F) {
   RI_  = &getAnalysis<ReduceIndexation>();
   RE_  = &getAnalysis<RelativeExecutions>();
   RMM_ = &getAnalysis<RelativeMinMax>();
+  RD_  = &getAnalysis<ReuseDistance>();
+  AS_  = ClAliasSets ? &getAnalysisID<Pass>(GetAliasSetsID()) : nullptr;
 
   Module_  = F.getParent();
   Context_ = &Module_->getContext();
@@ -88,17 +113,33 @@ bool SelectivePageMigration::runOnFunction(Function &F) {
   }
 
   Calls_.clear();
+  Inspectors_.clear();
+  ValueCache_.clear();
 
   SPM_DEBUG(dbgs() << "SelectivePageMigration: processing function "
                    << F.getName() << "\n");
 
-  std::vector<Type*> ReuseFnFormals = { VoidPtrTy, IntTy, IntTy, IntTy };
+  std::vector<Type*> ReuseFnFormals =
+    { VoidPtrTy, IntTy, IntTy, IntTy, IntTy };
   FunctionType *ReuseFnType = FunctionType::get(VoidTy, ReuseFnFormals, false);
   ReuseFn_ =
     F.getParent()->getOrInsertFunction("__spm_get", ReuseFnType);
   ReuseFnDestroy_ =
     F.getParent()->getOrInsertFunction("__spm_give", ReuseFnType);
 
+  // __spm_get_merged(N, Array1, Min1, Max1, Reuse1, Distance1, ...)
+  std::vector<Type*> MergedFnFormals = { IntTy };
+  FunctionType *MergedFnType = FunctionType::get(VoidTy, MergedFnFormals, true);
+  MergedFn_ =
+    F.getParent()->getOrInsertFunction("__spm_get_merged", MergedFnType);
+
+  std::vector<Type*> InspectFnFormals =
+    { VoidPtrTy, VoidPtrTy, IntTy, IntTy, IntTy, IntTy, IntTy, IntTy };
+  FunctionType *InspectFnType =
+    FunctionType::get(VoidTy, InspectFnFormals, false);
+  InspectFn_ =
+    F.getParent()->getOrInsertFunction("__spm_inspect", InspectFnType);
+
   std::set<BasicBlock*> Processed;
   auto Entry = DT_->getRootNode();
   for (auto ET = po_begin(Entry), EE = po_end(Entry); ET != EE; ++ET) {
@@ -129,10 +170,15 @@ bool SelectivePageMigration::runOnFunction(Function &F) {
     }
   }
 
-  for (auto &CI : Calls_) {
+  std::vector<CallInfo> Calls(Calls_.begin(), Calls_.end());
+  if (AS_)
+    mergeAliasingCalls(Calls);
+
+  for (auto &CI : Calls) {
     IRBuilder<> IRB(CI.Preheader->getTerminator());
     Value *VoidArray = IRB.CreateBitCast(CI.Array, VoidPtrTy);
-    std::vector<Value*> Args = { VoidArray, CI.Min, CI.Max, CI.Reuse };
+    std::vector<Value*> Args = { VoidArray, CI.Min, CI.Max, CI.Reuse,
+                                 CI.Distance };
     CallInst *CR = IRB.CreateCall(ReuseFn_, Args);
     IRB.SetInsertPoint(&(*CI.Final->begin()));
     IRB.CreateCall(ReuseFnDestroy_, Args);
@@ -140,6 +186,21 @@ bool SelectivePageMigration::runOnFunction(Function &F) {
                      << "\n");
   }
 
+  for (auto &II : Inspectors_) {
+    IRBuilder<> IRB(II.Preheader->getTerminator());
+    Value *VoidArray = IRB.CreateBitCast(II.Array, VoidPtrTy);
+    Value *VoidIndexArray = IRB.CreateBitCast(II.IndexArray, VoidPtrTy);
+    Value *IndexSize = ConstantInt::get(IntTy, II.IndexSize);
+    Value *Scale  = II.Scale.getExprValue(64, IRB, Module_, &ValueCache_);
+    Value *Offset = II.Offset.getExprValue(64, IRB, Module_, &ValueCache_);
+    std::vector<Value*> Args = { VoidArray, VoidIndexArray, II.IndexMin,
+                                 II.IndexMax, IndexSize, Scale, Offset,
+                                 II.Reuse };
+    CallInst *CR = IRB.CreateCall(InspectFn_, Args);
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: inspector call: " << *CR
+                     << "\n");
+  }
+
   return false;
 }
 
@@ -195,6 +256,20 @@ bool SelectivePageMigration::generateCallFor(Loop *L, Instruction *I) {
     }
   }
 
+  // Subscripts that depend on a value loaded inside the nest can only be
+  // bounded by inspecting the loaded values at runtime.
+  LoadInst *Index;
+  Expr ScaleEx, OffsetEx;
+  if (RI_->reduceIndirection(Final, Subscript, Index, ScaleEx, OffsetEx)) {
+    if (!ClInspector) {
+      SPM_DEBUG(dbgs() << "SelectivePageMigration: indirect subscript "
+                       << Subscript << " requires -spm-inspector\n");
+      return false;
+    }
+    return generateInspectorFor(Final, Array, Index, ScaleEx, OffsetEx,
+                                ReuseEx * Size);
+  }
+
   Expr MinEx, MaxEx;
   if (!RMM_->getMinMax(Subscript, MinEx, MaxEx)) {
     SPM_DEBUG(dbgs() << "SelectivePageMigration: could calculate min/max for "
@@ -204,27 +279,59 @@ bool SelectivePageMigration::generateCallFor(Loop *L, Instruction *I) {
   SPM_DEBUG(dbgs() << "SelectivePageMigration: min/max for subscript "
                    << Subscript << ": " << MinEx << ", " << MaxEx << "\n");
 
-  IRBuilder<> IRB(Final->getLoopPreheader()->getTerminator());
-  Value *Reuse = (ReuseEx * Size).getExprValue(64, IRB, Module_);
-  Value *Min   = MinEx.getExprValue(64, IRB, Module_);
-  Value *Max   = MaxEx.getExprValue(64, IRB, Module_);
+  if (!LoopInfoExpr::IsLoopInvariant(Final, MinEx) ||
+      !LoopInfoExpr::IsLoopInvariant(Final, MaxEx)) {
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: min/max vary inside loop "
+                     << Final->getHeader()->getName() << "\n");
+    return false;
+  }
 
-  SPM_DEBUG(dbgs() << "SelectivePageMigration: values for reuse, min, max: "
-                   << *Reuse << ", " << *Min << ", " << *Max << "\n");
+  Expr DistanceEx = RD_->getReuseDistance(L, Final, Subscript, Size);
+  SPM_DEBUG(dbgs() << "SelectivePageMigration: reuse distance for subscript "
+                   << Subscript << ": " << DistanceEx << "\n");
 
-  CallInfo CI = { Preheader, Exit, Array, Min, Max, Reuse };
+  IRBuilder<> IRB(Final->getLoopPreheader()->getTerminator());
+  IntegerType *IntTy = IntegerType::getInt64Ty(*Context_);
+  Value *Reuse = (ReuseEx * Size).getExprValue(64, IRB, Module_, &ValueCache_);
+  Value *Min   = MinEx.getExprValue(64, IRB, Module_, &ValueCache_);
+  Value *Max   = MaxEx.getExprValue(64, IRB, Module_, &ValueCache_);
+  Value *Distance = DistanceEx.isValid() ?
+    DistanceEx.getExprValue(64, IRB, Module_, &ValueCache_) :
+    ConstantInt::get(IntTy, -1);
+
+  SPM_DEBUG(dbgs() << "SelectivePageMigration: values for reuse, min, max, "
+                      "distance: " << *Reuse << ", " << *Min << ", " << *Max
+                   << ", " << *Distance << "\n");
+
+  // Pointers into the same object (e.g. A and A + Off) share a single call.
+  Value *Object = GetUnderlyingObject(Array, DL_);
+  CallInfo CI = { Preheader, Exit, Object, Array, Min, Max, Reuse, Distance };
   auto Call = Calls_.insert(CI);
   if (!Call.second) {
     IRBuilder<> IRB(Preheader->getTerminator());
     CallInfo SCI = *Call.first;
 
-    Value *CmpMin = IRB.CreateICmp(CmpInst::ICMP_SLT, SCI.Min, CI.Min);
-    SCI.Min = IRB.CreateSelect(CmpMin, SCI.Min, CI.Min);
+    // Rebase the new offsets onto the array of the existing call.
+    if (SCI.Array != CI.Array) {
+      Value *Delta = IRB.CreateSub(IRB.CreatePtrToInt(CI.Array, IntTy),
+                                   IRB.CreatePtrToInt(SCI.Array, IntTy));
+      CI.Min = IRB.CreateAdd(CI.Min, Delta);
+      CI.Max = IRB.CreateAdd(CI.Max, Delta);
+    }
+
+    // Identical bounds share a single value, so no select is needed for them.
+    if (SCI.Min != CI.Min) {
+      Value *CmpMin = IRB.CreateICmp(CmpInst::ICMP_SLT, SCI.Min, CI.Min);
+      SCI.Min = IRB.CreateSelect(CmpMin, SCI.Min, CI.Min);
+    }
 
-    Value *CmpMax = IRB.CreateICmp(CmpInst::ICMP_SGT, SCI.Max, CI.Max);
-    SCI.Max = IRB.CreateSelect(CmpMax, SCI.Max, CI.Max);
+    if (SCI.Max != CI.Max) {
+      Value *CmpMax = IRB.CreateICmp(CmpInst::ICMP_SGT, SCI.Max, CI.Max);
+      SCI.Max = IRB.CreateSelect(CmpMax, SCI.Max, CI.Max);
+    }
 
     SCI.Reuse = IRB.CreateAdd(SCI.Reuse, CI.Reuse);
+    SCI.Distance = mergeDistances(IRB, SCI.Distance, CI.Distance);
 
     Calls_.erase(SCI);
     Calls_.insert(SCI);
@@ -233,3 +340,145 @@ bool SelectivePageMigration::generateCallFor(Loop *L, Instruction *I) {
   return true;
 }
 
+
+void SelectivePageMigration::mergeAliasingCalls(std::vector<CallInfo> &Calls) {
+  IntegerType *IntTy     = IntegerType::getInt64Ty(*Context_);
+  PointerType *VoidPtrTy = PointerType::getInt8PtrTy(*Context_);
+
+  // Alias sets may join distinct objects, so whether two ranges overlap is
+  // only known at runtime: each group of calls in the same preheader and alias
+  // set is replaced by a single __spm_get_merged call, which merges the
+  // overlapping ranges transitively and migrates each resulting range once.
+  std::map<std::pair<BasicBlock*, int>, std::vector<CallInfo*>> Groups;
+  for (auto &CI : Calls) {
+    int Set = GetValueSetKey(AS_, CI.Object);
+    if (Set)
+      Groups[std::make_pair(CI.Preheader, Set)].push_back(&CI);
+  }
+
+  std::set<CallInfo*> Merged;
+  for (auto &G : Groups) {
+    std::vector<CallInfo*> &Group = G.second;
+    if (Group.size() < 2)
+      continue;
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: merging " << Group.size()
+                     << " calls in alias set " << G.first.second << "\n");
+
+    IRBuilder<> IRB(G.first.first->getTerminator());
+    std::vector<Value*> Args = { ConstantInt::get(IntTy, Group.size()) };
+    std::vector<Value*> VoidArrays;
+    for (auto CI : Group) {
+      Value *VoidArray = IRB.CreateBitCast(CI->Array, VoidPtrTy);
+      Args.insert(Args.end(),
+                  { VoidArray, CI->Min, CI->Max, CI->Reuse, CI->Distance });
+      VoidArrays.push_back(VoidArray);
+      Merged.insert(CI);
+    }
+    CallInst *CR = IRB.CreateCall(MergedFn_, Args);
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: call instruction: " << *CR
+                     << "\n");
+
+    for (unsigned I = 0; I < Group.size(); ++I) {
+      CallInfo *CI = Group[I];
+      IRB.SetInsertPoint(&(*CI->Final->begin()));
+      std::vector<Value*> GiveArgs = { VoidArrays[I], CI->Min, CI->Max,
+                                       CI->Reuse, CI->Distance };
+      IRB.CreateCall(ReuseFnDestroy_, GiveArgs);
+    }
+  }
+
+  std::vector<CallInfo> Remaining;
+  for (auto &CI : Calls)
+    if (!Merged.count(&CI))
+      Remaining.push_back(CI);
+  Calls.swap(Remaining);
+}
+
+Value *SelectivePageMigration::mergeDistances(IRBuilder<> &IRB, Value *A,
+                                              Value *B) {
+  if (A == B)
+    return A;
+
+  Constant *Zero = ConstantInt::get(A->getType(), 0);
+  Constant *MinusOne = ConstantInt::get(A->getType(), -1);
+  Value *Unknown = IRB.CreateOr(IRB.CreateICmp(CmpInst::ICMP_SLT, A, Zero),
+                                IRB.CreateICmp(CmpInst::ICMP_SLT, B, Zero));
+  Value *CmpMax = IRB.CreateICmp(CmpInst::ICMP_SGT, A, B);
+  return IRB.CreateSelect(Unknown, MinusOne, IRB.CreateSelect(CmpMax, A, B));
+}
+
+bool SelectivePageMigration::generateInspectorFor(Loop *Final, Value *Array,
+                                                  LoadInst *Index,
+                                                  Expr ScaleEx, Expr OffsetEx,
+                                                  Expr ReuseEx) {
+  BasicBlock *Preheader = Final->getLoopPreheader();
+
+  Value *IndexArray;
+  Expr IndexSubscript;
+  if (!RI_->reduceLoad(Index, IndexArray, IndexSubscript)) {
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: could not reduce index load "
+                     << *Index << "\n");
+    return false;
+  }
+
+  if (!Index->getType()->isIntegerTy()) {
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: index " << *Index
+                     << " is not an integer\n");
+    return false;
+  }
+
+  if (Instruction *AI = dyn_cast<Instruction>(IndexArray)) {
+    if (!DT_->dominates(AI->getParent(), Preheader) &&
+         AI->getParent() != Preheader) {
+      SPM_DEBUG(dbgs() << "SelectivePageMigration: index array does not "
+                          "dominate loop preheader\n");
+      return false;
+    }
+  }
+
+  // The index array itself may be written inside the nest. As migration is
+  // only a placement hint, a stale page set costs performance, not
+  // correctness.
+  Expr IndexMinEx, IndexMaxEx;
+  if (!RMM_->getMinMax(IndexSubscript, IndexMinEx, IndexMaxEx) ||
+      !LoopInfoExpr::IsLoopInvariant(Final, IndexMinEx) ||
+      !LoopInfoExpr::IsLoopInvariant(Final, IndexMaxEx)) {
+    SPM_DEBUG(dbgs() << "SelectivePageMigration: could not bound index "
+                        "subscript " << IndexSubscript << "\n");
+    return false;
+  }
+  SPM_DEBUG(dbgs() << "SelectivePageMigration: inspecting " << *IndexArray
+                   << " in [" << IndexMinEx << ", " << IndexMaxEx << "] for "
+                   << *Array << " + " << ScaleEx << " * " << *Index << " + "
+                   << OffsetEx << "\n");
+
+  IRBuilder<> IRB(Preheader->getTerminator());
+  Value *Reuse    = ReuseEx.getExprValue(64, IRB, Module_, &ValueCache_);
+  Value *IndexMin = IndexMinEx.getExprValue(64, IRB, Module_, &ValueCache_);
+  Value *IndexMax = IndexMaxEx.getExprValue(64, IRB, Module_, &ValueCache_);
+  unsigned IndexSize = DL_->getTypeAllocSize(Index->getType());
+
+  InspectorInfo II = { Preheader, Array, IndexArray, IndexMin, IndexMax, Reuse,
+                       ScaleEx, OffsetEx, IndexSize };
+  auto Inspector = Inspectors_.insert(II);
+  if (!Inspector.second) {
+    InspectorInfo SII = *Inspector.first;
+
+    if (SII.IndexMin != IndexMin) {
+      Value *CmpMin = IRB.CreateICmp(CmpInst::ICMP_SLT, SII.IndexMin, IndexMin);
+      SII.IndexMin = IRB.CreateSelect(CmpMin, SII.IndexMin, IndexMin);
+    }
+
+    if (SII.IndexMax != IndexMax) {
+      Value *CmpMax = IRB.CreateICmp(CmpInst::ICMP_SGT, SII.IndexMax, IndexMax);
+      SII.IndexMax = IRB.CreateSelect(CmpMax, SII.IndexMax, IndexMax);
+    }
+
+    SII.Reuse = IRB.CreateAdd(SII.Reuse, Reuse);
+
+    Inspectors_.erase(SII);
+    Inspectors_.insert(SII);
+  }
+
+  return true;
+}
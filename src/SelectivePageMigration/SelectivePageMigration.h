@@ -1,10 +1,12 @@
 #ifndef _SELECTIVEPAGEMIGRATION_H_
 #define _SELECTIVEPAGEMIGRATION_H_
 
+#include "DepGraphBridge.h"
 #include "PythonInterface.h"
 #include "ReduceIndexation.h"
 #include "RelativeExecutions.h"
 #include "RelativeMinMax.h"
+#include "ReuseDistance.h"
 
 #include "llvm/Pass.h"
 #include "llvm/Analysis/Dominators.h"
@@ -23,37 +25,79 @@ public:
   virtual bool runOnFunction(Function &F);
 
 private:
+  Pass               *AS_;
   DataLayout         *DL_;
   DominatorTree      *DT_;
   LoopInfo           *LI_;
   ReduceIndexation   *RI_;
   RelativeExecutions *RE_;
   RelativeMinMax     *RMM_;
-  SymPyInterface     *SPI_;
+  ReuseDistance      *RD_;
 
   LLVMContext *Context_;
   Module      *Module_;
   Constant    *ReuseFn_;
   Constant    *ReuseFnDestroy_;
+  Constant    *MergedFn_;
+  Constant    *InspectFn_;
+
+  // Shares the code generated for common subexpressions within a preheader.
+  ExprValueCache ValueCache_;
 
   bool generateCallFor(Loop *L, Instruction *I);
+  bool generateInspectorFor(Loop *Final, Value *Array, LoadInst *Index,
+                            Expr ScaleEx, Expr OffsetEx, Expr ReuseEx);
+
+  // Calls are keyed on the underlying object of the array. Calls that remain
+  // separate but whose objects share an alias set are emitted here, as one
+  // runtime call per group, and removed from Calls.
+  struct CallInfo;
+  void mergeAliasingCalls(std::vector<CallInfo> &Calls);
+  // Distances of -1 are unknown and stay so when merged.
+  Value *mergeDistances(IRBuilder<> &IRB, Value *A, Value *B);
 
+  // Min & Max are offsets relative to Array, which is one of the pointers
+  // into Object. Distance is the estimated reuse distance in bytes, or -1.
   struct CallInfo {
     BasicBlock *Preheader, *Final;
-    Value *Array, *Min, *Max, *Reuse;
+    Value *Object, *Array, *Min, *Max, *Reuse, *Distance;
 
     bool operator==(const CallInfo &Other) const {
-      return Preheader == Other.Preheader && Array == Other.Array;
+      return Preheader == Other.Preheader && Object == Other.Object;
     }
   };
 
   struct CallInfoHasher {
     size_t operator()(const CallInfo &CI) const {
-      return (size_t)((long)CI.Preheader + (long)CI.Array);
+      return (size_t)((long)CI.Preheader + (long)CI.Object);
     }
   };
 
   std::unordered_set<CallInfo, CallInfoHasher> Calls_;
+
+  // Indirect accesses Array[Scale * IndexArray[i] + Offset], whose touched
+  // pages are collected at runtime by scanning IndexArray[IndexMin..IndexMax].
+  struct InspectorInfo {
+    BasicBlock *Preheader;
+    Value *Array, *IndexArray, *IndexMin, *IndexMax, *Reuse;
+    Expr Scale, Offset;
+    unsigned IndexSize;
+
+    bool operator==(const InspectorInfo &Other) const {
+      return Preheader == Other.Preheader && Array == Other.Array &&
+             IndexArray == Other.IndexArray && IndexSize == Other.IndexSize &&
+             Scale == Other.Scale && Offset == Other.Offset;
+    }
+  };
+
+  struct InspectorInfoHasher {
+    size_t operator()(const InspectorInfo &II) const {
+      return (size_t)((long)II.Preheader + (long)II.Array +
+                      (long)II.IndexArray);
+    }
+  };
+
+  std::unordered_set<InspectorInfo, InspectorInfoHasher> Inspectors_;
 };
 
 #endif
@@ -0,0 +1,235 @@
+//===------------------------- SummationCache.cpp -------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "SummationCache.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+static cl::opt<bool>
+  ClDebug("summation-cache-debug",
+          cl::desc("Enable debugging for the summation cache"),
+          cl::Hidden, cl::init(false));
+
+#define SC_DEBUG(X) { if (ClDebug) { X; } }
+
+// Bump whenever the key or the result format changes.
+static const char *CacheVersion = "spm-sum-1";
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+// Symbol-independent form of an expression, used to order the operands of
+// commutative operations before symbols are renamed. Returns an empty string
+// for expressions the cache does not handle.
+static string GetAnonymous(const GiNaC::ex &Ex) {
+  std::ostringstream Str;
+  if (GiNaC::is_a<GiNaC::symbol>(Ex)) {
+    Str << "$";
+  } else if (GiNaC::is_a<GiNaC::numeric>(Ex)) {
+    Str << Ex;
+  } else if (GiNaC::is_a<GiNaC::add>(Ex) || GiNaC::is_a<GiNaC::mul>(Ex) ||
+             GiNaC::is_a<GiNaC::power>(Ex) ||
+             GiNaC::is_a<GiNaC::function>(Ex)) {
+    std::vector<string> Ops;
+    for (size_t Idx = 0; Idx < Ex.nops(); ++Idx) {
+      Ops.push_back(GetAnonymous(Ex.op(Idx)));
+      if (Ops.back().empty())
+        return "";
+    }
+    if (GiNaC::is_a<GiNaC::add>(Ex) || GiNaC::is_a<GiNaC::mul>(Ex))
+      std::sort(Ops.begin(), Ops.end());
+
+    if (GiNaC::is_a<GiNaC::add>(Ex))
+      Str << "+(";
+    else if (GiNaC::is_a<GiNaC::mul>(Ex))
+      Str << "*(";
+    else if (GiNaC::is_a<GiNaC::power>(Ex))
+      Str << "^(";
+    else
+      Str << GiNaC::ex_to<GiNaC::function>(Ex).get_name() << "(";
+    for (size_t Idx = 0; Idx < Ops.size(); ++Idx)
+      Str << (Idx ? "," : "") << Ops[Idx];
+    Str << ")";
+  } else {
+    return "";
+  }
+  return Str.str();
+}
+
+static string GetHash(const string &Str) {
+  // 64-bit FNV-1a.
+  uint64_t Hash = 14695981039346656037ULL;
+  for (unsigned char C : Str) {
+    Hash ^= C;
+    Hash *= 1099511628211ULL;
+  }
+  char Buf[17];
+  snprintf(Buf, sizeof(Buf), "%016llx", (unsigned long long)Hash);
+  return Buf;
+}
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+string SummationCache::getCanonical(const GiNaC::ex &Ex, Renaming &R) const {
+  std::ostringstream Str;
+  if (GiNaC::is_a<GiNaC::symbol>(Ex)) {
+    string Name = GiNaC::ex_to<GiNaC::symbol>(Ex).get_name();
+    if (!R.Names.count(Name)) {
+      string Canonical = "s" + std::to_string(R.Names.size());
+      R.Names[Name] = Canonical;
+      R.ToCanonical[Ex] = GiNaC::symbol(Canonical);
+      R.FromCanonical[Canonical] = Ex;
+    }
+    Str << R.Names[Name];
+  } else if (GiNaC::is_a<GiNaC::numeric>(Ex)) {
+    Str << Ex;
+  } else {
+    // Operands of commutative operations are visited in the order of their
+    // anonymous forms, so that the renaming does not depend on the order
+    // GiNaC happened to choose.
+    std::vector<std::pair<string, GiNaC::ex>> Ops;
+    for (size_t Idx = 0; Idx < Ex.nops(); ++Idx)
+      Ops.push_back(std::make_pair(GetAnonymous(Ex.op(Idx)), Ex.op(Idx)));
+    if (GiNaC::is_a<GiNaC::add>(Ex) || GiNaC::is_a<GiNaC::mul>(Ex))
+      std::stable_sort(Ops.begin(), Ops.end(),
+                       [](const std::pair<string, GiNaC::ex> &A,
+                          const std::pair<string, GiNaC::ex> &B) {
+                         return A.first < B.first;
+                       });
+
+    if (GiNaC::is_a<GiNaC::add>(Ex))
+      Str << "+(";
+    else if (GiNaC::is_a<GiNaC::mul>(Ex))
+      Str << "*(";
+    else if (GiNaC::is_a<GiNaC::power>(Ex))
+      Str << "^(";
+    else
+      Str << GiNaC::ex_to<GiNaC::function>(Ex).get_name() << "(";
+    for (size_t Idx = 0; Idx < Ops.size(); ++Idx)
+      Str << (Idx ? "," : "") << getCanonical(Ops[Idx].second, R);
+    Str << ")";
+  }
+  return Str.str();
+}
+
+string SummationCache::getKey(Expr Summand, Expr Var, Expr Lower, Expr Upper,
+                              Renaming &R) const {
+  if (!Summand.isValid() || !Lower.isValid() || !Upper.isValid())
+    return "";
+
+  for (auto &Ex : { Summand, Var, Lower, Upper })
+    if (GetAnonymous(Ex.getExpr()).empty())
+      return "";
+
+  // The summation variable is always s0.
+  string Key = getCanonical(Var.getExpr(), R);
+  Key += ";" + getCanonical(Lower.getExpr(), R);
+  Key += ";" + getCanonical(Upper.getExpr(), R);
+  Key += ";" + getCanonical(Summand.getExpr(), R);
+  return Key;
+}
+
+string SummationCache::getPath(const string &Key) const {
+  return Dir_ + "/" + GetHash(Key) + ".sum";
+}
+
+bool SummationCache::readEntry(const string &Key, string &Result) const {
+  std::ifstream File(getPath(Key).c_str());
+  string Version, StoredKey;
+  if (!File || !std::getline(File, Version) || Version != CacheVersion ||
+      !std::getline(File, StoredKey) || StoredKey != Key ||
+      !std::getline(File, Result))
+    return false;
+  return true;
+}
+
+void SummationCache::writeEntry(const string &Key,
+                                const string &Result) const {
+  mkdir(Dir_.c_str(), 0755);
+
+  // Write to a private file first, so that concurrent compilations never see
+  // a partial entry.
+  string Path = getPath(Key);
+  string Tmp = Path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream File(Tmp.c_str());
+    if (!File)
+      return;
+    File << CacheVersion << "\n" << Key << "\n" << Result << "\n";
+    if (!File) {
+      std::remove(Tmp.c_str());
+      return;
+    }
+  }
+  if (std::rename(Tmp.c_str(), Path.c_str()))
+    std::remove(Tmp.c_str());
+}
+
+bool SummationCache::lookup(Expr Summand, Expr Var, Expr Lower, Expr Upper,
+                            Expr &Result) {
+  Renaming R;
+  string Key = getKey(Summand, Var, Lower, Upper, R);
+  if (Key.empty())
+    return false;
+
+  string Str;
+  auto It = Entries_.find(Key);
+  if (It != Entries_.end()) {
+    Str = It->second;
+  } else if (!Dir_.empty() && readEntry(Key, Str)) {
+    Entries_[Key] = Str;
+  } else {
+    SC_DEBUG(dbgs() << "SummationCache: miss for " << Key << "\n");
+    return false;
+  }
+
+  try {
+    GiNaC::parser Reader(R.FromCanonical, true);
+    Result = Expr(Reader(Str));
+  } catch (std::exception &E) {
+    SC_DEBUG(dbgs() << "SummationCache: could not parse " << Str << ": "
+                    << E.what() << "\n");
+    return false;
+  }
+
+  SC_DEBUG(dbgs() << "SummationCache: hit for " << Key << ": " << Result
+                  << "\n");
+  return true;
+}
+
+void SummationCache::insert(Expr Summand, Expr Var, Expr Lower, Expr Upper,
+                            Expr Result) {
+  Renaming R;
+  string Key = getKey(Summand, Var, Lower, Upper, R);
+  if (Key.empty() || !Result.isValid())
+    return;
+
+  // The result can only be stored if it is expressed in the input symbols.
+  for (auto &Sym : Result.getSymbols())
+    if (!R.Names.count(Sym.getSymbolString()))
+      return;
+
+  std::ostringstream Str;
+  Str << Result.getExpr().subs(R.ToCanonical);
+  Entries_[Key] = Str.str();
+  if (!Dir_.empty())
+    writeEntry(Key, Str.str());
+
+  SC_DEBUG(dbgs() << "SummationCache: stored " << Key << ": " << Str.str()
+                  << "\n");
+}
@@ -0,0 +1,40 @@
+#ifndef _SUMMATIONCACHE_H_
+#define _SUMMATIONCACHE_H_
+
+#include "Expr.h"
+
+#include <map>
+#include <string>
+
+// Closed forms of summations, keyed by a canonical form of the summand &
+// bounds in which symbols are renamed by order of appearance. Results are
+// kept in memory and, if a directory is given, on disk so that later
+// compilations and other translation units can reuse them.
+class SummationCache {
+public:
+  void setDirectory(string Dir) { Dir_ = Dir; }
+
+  bool lookup(Expr Summand, Expr Var, Expr Lower, Expr Upper, Expr &Result);
+  void insert(Expr Summand, Expr Var, Expr Lower, Expr Upper, Expr Result);
+
+private:
+  // Maps the symbols of an entry to their canonical names & back.
+  struct Renaming {
+    std::map<string, string> Names;
+    GiNaC::exmap ToCanonical;
+    GiNaC::symtab FromCanonical;
+  };
+
+  string getCanonical(const GiNaC::ex &Ex, Renaming &R) const;
+  string getKey(Expr Summand, Expr Var, Expr Lower, Expr Upper,
+                Renaming &R) const;
+  string getPath(const string &Key) const;
+
+  bool readEntry(const string &Key, string &Result) const;
+  void writeEntry(const string &Key, const string &Result) const;
+
+  string Dir_;
+  std::map<string, string> Entries_;
+};
+
+#endif
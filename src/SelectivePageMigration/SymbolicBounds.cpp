@@ -0,0 +1,28 @@
+//===------------------------- SymbolicBounds.cpp -------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "SymbolicBounds.h"
+
+#include "llvm/PassRegistry.h"
+
+using namespace llvm;
+
+// Defined in SymbolicRA.so (SymbolicRA/SymbolicBoundsShim.cpp). Only called
+// when the analysis is available, so the reference is bound lazily.
+extern "C" bool SymbolicRA_GetBounds(Pass *SRA, Value *V, std::string *Lower,
+                                     std::string *Upper);
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+AnalysisID GetSymbolicRangeAnalysisID() {
+  // Looked up by name so that SymbolicRA.so only has to be loaded when the
+  // analysis is actually requested.
+  const PassInfo *PI = PassRegistry::getPassRegistry()->getPassInfo("sra");
+  return PI ? PI->getTypeInfo() : nullptr;
+}
+
+bool GetSymbolicBounds(Pass *SRA, Value *V, std::string &Lower,
+                       std::string &Upper) {
+  return SymbolicRA_GetBounds(SRA, V, &Lower, &Upper);
+}
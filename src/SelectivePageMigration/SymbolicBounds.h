@@ -0,0 +1,23 @@
+#ifndef _SYMBOLICBOUNDS_H_
+#define _SYMBOLICBOUNDS_H_
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Value.h"
+
+#include <string>
+
+// Bridge to SymbolicRA's SymbolicRangeAnalysis. SymbolicRA has an Expr class
+// of its own, so none of its headers are included here: the pass is looked
+// up by name and its bounds come from a C entry point in SymbolicRA.so, as
+// strings in GiNaC syntax in which symbols carry the names of the values they
+// stand for.
+
+// Returns the ID of SymbolicRangeAnalysis, or null if SymbolicRA.so has not
+// been loaded.
+llvm::AnalysisID GetSymbolicRangeAnalysisID();
+
+// Returns false if the analysis has no finite bounds for V.
+bool GetSymbolicBounds(llvm::Pass *SRA, llvm::Value *V, std::string &Lower,
+                       std::string &Upper);
+
+#endif
@@ -0,0 +1,26 @@
+//===----------------------- SymbolicBoundsShim.cpp -----------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "SymbolicRangeAnalysis.h"
+
+using namespace llvm;
+
+/* ************************************************************************** */
+/* ************************************************************************** */
+
+// C entry point for modules that want the analysis' bounds without including
+// its headers: SelectivePageMigration has an Expr class of its own, so its
+// translation units must not see ours. Bounds are returned as strings in
+// GiNaC syntax; returns false if the analysis has no finite bounds for V.
+extern "C" bool SymbolicRA_GetBounds(Pass *SRA, Value *V, std::string *Lower,
+                                     std::string *Upper) {
+  Range R = static_cast<SymbolicRangeAnalysis*>(SRA)->getRange(V);
+  Expr RLower = R.getLower(), RUpper = R.getUpper();
+  if (RLower.isMinusInf() || RLower.isPlusInf() ||
+      RUpper.isMinusInf() || RUpper.isPlusInf())
+    return false;
+
+  *Lower = RLower.getStringRepr();
+  *Upper = RUpper.getStringRepr();
+  return true;
+}